@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "render.hh"
+#include "text.hh"
+
+// shared by the benchmarks in bench/, each of which prints one JSON object:
+// {"benchmark": name, "results": [{"name": ..., "iterations": ..., "min_us": ..., ...}]}
+// the exit code 77 tells meson a benchmark was skipped
+
+using bench_clock = std::chrono::steady_clock;
+
+struct samples_t {
+    std::string name;
+    std::vector<double> us;
+
+    void add(bench_clock::duration d) {
+        us.push_back(std::chrono::duration<double, std::micro>(d).count());
+    }
+
+    double percentile(double p) const {
+        std::vector<double> sorted = us;
+        std::sort(sorted.begin(), sorted.end());
+        size_t i = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+        return sorted[i];
+    }
+    double mean() const {
+        double sum = 0;
+        for (double x: us) {
+            sum += x;
+        }
+        return sum / us.size();
+    }
+};
+
+// times f() iterations times, after a few untimed runs to warm caches up
+template <typename F>
+samples_t measure(std::string name, size_t iterations, F&& f) {
+    samples_t samples {std::move(name), {}};
+    for (size_t i = 0; i < std::min<size_t>(iterations / 10 + 1, 10); i++) {
+        f();
+    }
+    samples.us.reserve(iterations);
+    for (size_t i = 0; i < iterations; i++) {
+        auto start = bench_clock::now();
+        f();
+        samples.add(bench_clock::now() - start);
+    }
+    return samples;
+}
+
+void report(const std::string& benchmark, const std::vector<samples_t>& results) {
+    std::printf("{\"benchmark\": \"%s\", \"results\": [", benchmark.c_str());
+    bool first = true;
+    for (const samples_t& s: results) {
+        if (s.us.empty()) {
+            continue;
+        }
+        std::printf(
+            "%s\n  {\"name\": \"%s\", \"iterations\": %zu, \"min_us\": %.3f, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}",
+            first ? "" : ",",
+            s.name.c_str(), s.us.size(), s.percentile(0), s.mean(), s.percentile(0.5), s.percentile(0.99), s.percentile(1)
+        );
+        first = false;
+    }
+    std::printf("\n]}\n");
+    std::fflush(stdout);
+}
+
+// benchmarks that draw need an X server, e.g. under xvfb-run
+void require_display() {
+    if (!std::getenv("DISPLAY")) {
+        std::cerr << "no DISPLAY, skipping" << std::endl;
+        std::exit(77);
+    }
+}
+
+// what the benchmarks that draw share: a connection and its screen, both
+// collected, and a text cache
+struct display_t {
+    connection_t connection;
+    screen_t screen{connection};
+    text_cache_t text;
+
+    display_t() {
+        connection.collect();
+        screen.collect(connection);
+    }
+
+    // returns once the server has handled everything sent before it
+    void sync() {
+        xcb_connection_t* c = connection.connection;
+        free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), nullptr));
+    }
+};
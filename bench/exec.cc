@@ -0,0 +1,50 @@
+#include <string>
+#include <vector>
+
+#include "bench.hh"
+#include "bar.hh"
+#include "providers.hh"
+#include "reactor.hh"
+#include "scheduler.hh"
+
+// the cost of one module run, from asking for a refresh until its output is
+// published, for each way a module can get its output
+int main() {
+    reactor_t reactor;
+    children_t children{reactor};
+
+    content_t content;
+    module_t argv_module;
+    argv_module.exec = command_t{std::vector<std::string>{"date", "+%N"}};
+    argv_module.interval = std::chrono::hours(1);
+    module_t shell_module;
+    shell_module.exec = command_t{std::string("date +%N | cat")};
+    shell_module.interval = std::chrono::hours(1);
+    content.modules = {argv_module, shell_module};
+    for (size_t i = 0; i < content.modules.size(); i++) {
+        content.publish(i, "");
+    }
+    scheduler_t scheduler{content, reactor, children, 1};
+    // both run once on their own at startup
+    while (scheduler.running > 0 || !scheduler.waiting.empty()) {
+        reactor.step();
+    }
+
+    const auto run = [&](size_t i) {
+        uint64_t version = content.modules[i].version;
+        scheduler.refresh(i);
+        while (content.modules[i].version == version) {
+            reactor.step();
+        }
+    };
+
+    std::vector<samples_t> results;
+    results.push_back(measure("exec argv", 500, [&]() { run(0); }));
+    results.push_back(measure("exec shell", 500, [&]() { run(1); }));
+
+    auto network = make_provider("network", "");
+    results.push_back(measure("provider network read", 2000, [&]() { network->read(); }));
+
+    report("exec", results);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench.hh"
+#include "actions.hh"
+#include "bar.hh"
+#include "reactor.hh"
+#include "render.hh"
+#include "scheduler.hh"
+#include "text.hh"
+
+// end to end, from a button press sent to the bar until the frame showing
+// the clicked module's new output has been drawn by the server
+// the click runs the module's left_click action, whose exit refreshes the module
+int main() {
+    require_display();
+    reactor_t reactor;
+    children_t children{reactor};
+    display_t display;
+    const auto& c = display.connection.connection;
+
+    content_t content;
+    module_t module;
+    module.exec = command_t{std::vector<std::string>{"date", "+%N"}};
+    module.left_click = command_t{std::vector<std::string>{"true"}};
+    module.interval = std::chrono::hours(1);
+    module.gravity = aabb_t::direction::left;
+    content.modules = {module};
+    content.publish(0, "");
+
+    const std::string font = "monospace";
+    const double font_size = 12;
+    int height = std::ceil(display.text.metrics(font, font_size).height);
+    aabb_t area = display.screen.aabb;
+    bar_t bar{display.connection, display.screen, content, display.text, area.chop(aabb_t::direction::top, height), backend_t::shm};
+    bar.font = font;
+    bar.font_size = font_size;
+    bar.foreground = {1, 1, 1};
+    bar.background = {0, 0, 0};
+
+    scheduler_t scheduler{content, reactor, children, 1};
+    actions_t actions{content, children, scheduler};
+
+    reactor.frame_interval = std::chrono::microseconds(0);
+    reactor.add(xcb_get_file_descriptor(c), [](uint32_t) {});
+    reactor.add_idle([&]() {
+        while (xcb_generic_event_t* event = xcb_poll_for_event(c)) {
+            event_result_t result = bar.handle_event(event);
+            if (result.clicked) {
+                actions.click(result.clicked - content.modules.data(), result.button);
+            }
+            if (result.damaged) {
+                reactor.request_frame();
+            }
+            free(event);
+        }
+        xcb_flush(c);
+    });
+    uint64_t presented = 0;
+    reactor.on_frame = [&]() {
+        bar.redraw();
+        display.sync();
+        presented = content.modules[0].version;
+    };
+    // wait for the first run of the module, so there is something to click on
+    while (presented < 2) {
+        reactor.request_frame();
+        reactor.step(10);
+    }
+
+    const auto click = [&]() {
+        uint64_t version = content.modules[0].version;
+        xcb_button_press_event_t press;
+        std::memset(&press, 0, sizeof(press));
+        press.response_type = XCB_BUTTON_PRESS;
+        press.detail = 1;
+        press.event = bar.window.window;
+        press.root = display.screen.screen->root;
+        press.same_screen = 1;
+        press.event_x = bar.slots[0].aabb.x0 + 1;
+        press.event_y = bar.slots[0].aabb.y0 + 1;
+        xcb_send_event(c, false, bar.window.window, XCB_EVENT_MASK_BUTTON_PRESS, reinterpret_cast<const char*>(&press));
+        xcb_flush(c);
+        while (presented <= version) {
+            reactor.step();
+        }
+    };
+
+    std::vector<samples_t> results;
+    results.push_back(measure("button press to flushed frame", 200, click));
+
+    report("latency", results);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "apps.hh"
+#include "bench.hh"
+#include "fuzzy.hh"
+
+// the launcher's index and matcher over a corpus of 50k made up names:
+// building and mapping the index, the prefilter and the scorer on their own
+// for each instruction set, and a query typed a key at a time, narrowing as it goes
+// against searching the whole index again on every key
+int main() {
+    std::mt19937 random(42);
+    const char* syllables[] = {
+        "fire", "fox", "term", "ter", "al", "ac", "ri", "ty", "code", "gim", "p", "vim",
+        "in", "kscape", "lib", "re", "office", "x", "org", "-", "_", "ctl", "d", "2",
+    };
+    std::vector<app_t> apps;
+    for (size_t i = 0; i < 50000; i++) {
+        std::string name;
+        size_t parts = 2 + random() % 4;
+        for (size_t j = 0; j < parts; j++) {
+            name += syllables[random() % (sizeof(syllables) / sizeof(syllables[0]))];
+        }
+        name += std::to_string(i);
+        apps.push_back(app_t{name, "/usr/bin/" + name});
+    }
+    std::string path = "/tmp/ade-bench-" + std::to_string(getpid()) + ".index";
+
+    std::vector<samples_t> results;
+    results.push_back(measure("write 50k index", 20, [&]() { app_index_t::write(path, apps, 0, 0); }));
+    app_index_t index;
+    results.push_back(measure("map 50k index", 200, [&]() { index.map(path); }));
+    std::remove(path.c_str());
+
+    std::vector<uint32_t> out;
+    out.reserve(index.count);
+    const std::pair<const char*, simd_t> simds[] = {
+        {"scalar", simd_t::scalar}, {"sse2", simd_t::sse2}, {"avx2", simd_t::avx2},
+    };
+    for (const auto& [name, simd]: simds) {
+        if (simd > best_simd()) {
+            continue;
+        }
+        for (const char* query: {"f", "fx", "fire"}) {
+            uint32_t want = mask_of(query);
+            results.push_back(measure(std::string("prefilter ") + name + " '" + query + "'", 2000, [&]() {
+                out.clear();
+                prefilter(index.masks, index.count, want, out, simd);
+            }));
+        }
+        size_t matched = 0;
+        results.push_back(measure(std::string("score 50k ") + name + " 'fire'", 50, [&]() {
+            for (size_t i = 0; i < index.count; i++) {
+                matched += fuzzy_score(index.name(i), "fire", simd) >= 0;
+            }
+        }));
+    }
+
+    const std::string typed = "firefox";
+    search_t search{index};
+    results.push_back(measure("type 'firefox' incrementally", 500, [&]() {
+        for (size_t i = 1; i <= typed.size(); i++) {
+            search.set(typed.substr(0, i));
+            search.top(10);
+        }
+        search.set("");
+    }));
+    results.push_back(measure("type 'firefox', whole index every key", 500, [&]() {
+        for (size_t i = 1; i <= typed.size(); i++) {
+            search_t fresh{index};
+            fresh.set(typed.substr(0, i));
+            fresh.top(10);
+        }
+    }));
+    search.set("firefo");
+    results.push_back(measure("backspace and retype", 2000, [&]() {
+        search.set("firef");
+        search.top(10);
+        search.set("firefo");
+        search.top(10);
+    }));
+
+    report("launcher", results);
+    return 0;
+}
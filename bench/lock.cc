@@ -0,0 +1,83 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.hh"
+#include "blur.hh"
+#include "keys.hh"
+#include "lock.hh"
+#include "reactor.hh"
+#include "render.hh"
+#include "simd.hh"
+#include "text.hh"
+
+// the lock screen's pipeline: shrinking a capture of three 4k outputs and
+// blurring what is left, for each instruction set and on one thread against
+// every core, then with a display the whole of it, from lock() to the
+// server having drawn the covered screen, which should fit in a frame
+int main() {
+    const size_t width = 3 * 3840;
+    const size_t height = 2160;
+    const int scale = lock_t::scale;
+    std::mt19937 random(42);
+    std::vector<uint32_t> capture(width * height);
+    for (uint32_t& pixel: capture) {
+        pixel = random() & 0xffffff;
+    }
+    std::vector<uint32_t> small(width / scale * (height / scale));
+
+    std::vector<size_t> thread_counts = {1};
+    if (std::thread::hardware_concurrency() > 1) {
+        thread_counts.push_back(std::thread::hardware_concurrency());
+    }
+
+    std::vector<samples_t> results;
+    const std::pair<const char*, simd_t> simds[] = {
+        {"scalar", simd_t::scalar}, {"sse2", simd_t::sse2}, {"avx2", simd_t::avx2},
+    };
+    for (const auto& [name, simd]: simds) {
+        if (simd > best_simd()) {
+            continue;
+        }
+        for (size_t threads: thread_counts) {
+            std::string suffix = std::string(" ") + name + ", " + std::to_string(threads) + " threads";
+            results.push_back(measure("downsample 11520x2160" + suffix, 50, [&]() {
+                downsample(capture.data(), width, height, width, scale, small.data(), simd, threads);
+            }));
+            results.push_back(measure("blur 2880x540 radius 8" + suffix, 50, [&]() {
+                box_blur(small.data(), width / scale, height / scale, width / scale, 8, 3, simd, threads);
+            }));
+        }
+    }
+
+    if (std::getenv("DISPLAY")) {
+        reactor_t reactor;
+        display_t display;
+        keymap_t keymap;
+        keymap.load(display.connection.connection);
+        lock_t lock{display.connection, display.screen, reactor, display.text, keymap};
+        lock.font = "monospace";
+        lock.font_size = 12;
+        lock.line_height = std::ceil(display.text.metrics(lock.font, lock.font_size).height);
+        lock.foreground = {1, 1, 1};
+        lock.background = {0, 0, 0};
+
+        // the first attaches the shared memory
+        results.push_back(measure("first lock", 1, [&]() {
+            lock.lock();
+            display.sync();
+        }));
+        lock.unlock();
+        results.push_back(measure("lock to covered screen", 50, [&]() {
+            lock.lock();
+            display.sync();
+            lock.unlock();
+        }));
+    }
+
+    report("lock", results);
+    return 0;
+}
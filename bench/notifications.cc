@@ -0,0 +1,57 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bench.hh"
+#include "notifications.hh"
+#include "reactor.hh"
+#include "render.hh"
+#include "text.hh"
+
+// the cost of Notify itself, and of drawing the notification window after
+// one notification and after a storm of them
+int main() {
+    require_display();
+    reactor_t reactor;
+    display_t display;
+    const std::string font = "monospace";
+    const double font_size = 12;
+    int height = std::ceil(display.text.metrics(font, font_size).height);
+    const size_t lines = 4;
+    aabb_t area = display.screen.aabb;
+    aabb_t aabb = area.chop(aabb_t::direction::right, 300).chop(aabb_t::direction::top, lines * height);
+    notifications_t notifications{display.connection, display.screen, reactor, display.text, aabb, lines, 40, backend_t::shm};
+    notifications.font = font;
+    notifications.font_size = font_size;
+    notifications.line_height = height;
+    notifications.foreground = {1, 1, 1};
+    notifications.background = {0, 0, 0};
+
+    std::vector<samples_t> results;
+    size_t tick = 0;
+    results.push_back(measure("notify, new app", 10000, [&]() {
+        notifications.notify("app " + std::to_string(tick++), 0, "summary", "body", -1);
+    }));
+    results.push_back(measure("notify, same app burst", 10000, [&]() {
+        notifications.notify("chatty", 0, "summary", "body " + std::to_string(tick++), -1);
+    }));
+    results.push_back(measure("redraw after one notification", 1000, [&]() {
+        notifications.notify("app " + std::to_string(tick++), 0, "summary", "body", -1);
+        notifications.redraw();
+        display.sync();
+    }));
+    results.push_back(measure("redraw after a storm of 1000", 100, [&]() {
+        for (size_t i = 0; i < 1000; i++) {
+            notifications.notify("storm " + std::to_string(i % 8), 0, "summary", "body " + std::to_string(tick++), -1);
+        }
+        notifications.redraw();
+        display.sync();
+    }));
+    results.push_back(measure("redraw, nothing changed", 1000, [&]() {
+        notifications.redraw();
+        display.sync();
+    }));
+
+    report("notifications", results);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bench.hh"
+#include "bar.hh"
+#include "render.hh"
+#include "text.hh"
+
+// bar_t::redraw() for different numbers of modules, each time until the
+// server has finished with the frame
+int main() {
+    require_display();
+    display_t display;
+    const std::string font = "monospace";
+    const double font_size = 12;
+    int height = std::ceil(display.text.metrics(font, font_size).height);
+
+    std::vector<samples_t> results;
+    for (size_t n: {8, 32, 128}) {
+        content_t content;
+        for (size_t i = 0; i < n; i++) {
+            module_t module;
+            module.gravity = i % 2 ? aabb_t::direction::right : aabb_t::direction::left;
+            content.modules.push_back(module);
+            content.publish(i, "module " + std::to_string(i));
+        }
+        aabb_t area = display.screen.aabb;
+        bar_t bar{display.connection, display.screen, content, display.text, area.chop(aabb_t::direction::top, height), backend_t::shm};
+        bar.font = font;
+        bar.font_size = font_size;
+        bar.foreground = {1, 1, 1};
+        bar.background = {0, 0, 0};
+        bar.redraw();
+        display.sync();
+
+        const std::string suffix = " (" + std::to_string(n) + " modules)";
+        results.push_back(measure("full redraw" + suffix, 200, [&]() {
+            bar.reload();
+            bar.redraw();
+            display.sync();
+        }));
+        size_t tick = 0;
+        results.push_back(measure("one module changed" + suffix, 1000, [&]() {
+            // a handful of distinct texts, like a clock, so shaping is mostly cached
+            content.publish(0, "module 0 " + std::to_string(tick++ % 60));
+            bar.redraw();
+            display.sync();
+        }));
+        results.push_back(measure("nothing changed" + suffix, 1000, [&]() {
+            bar.redraw();
+            display.sync();
+        }));
+    }
+
+    report("redraw", results);
+    return 0;
+}
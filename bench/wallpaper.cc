@@ -0,0 +1,132 @@
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cairo/cairo.h>
+
+#include "bench.hh"
+#include "reactor.hh"
+#include "render.hh"
+#include "resample.hh"
+#include "simd.hh"
+#include "wallpaper.hh"
+
+// the wallpaper: scaling a 6000x4000 photo to fill a 4k output for each
+// instruction set, on one thread against every core, and reading back its
+// cached pixels, then with a display whose root has no wallpaper yet the
+// whole of it, on a miss, which decodes and scales, against a hit, which only
+// hands the cache to the server
+// what _XROOTPMAP_ID says the root's background is, 0 if nothing set one
+xcb_pixmap_t root_pixmap(xcb_connection_t* c, xcb_window_t root) {
+    xcb_get_property_reply_t* reply = xcb_get_property_reply(c,
+        xcb_get_property(c, false, root, _XROOTPMAP_ID, XCB_ATOM_PIXMAP, 0, 1), nullptr);
+    xcb_pixmap_t pixmap = 0;
+    if (reply && xcb_get_property_value_length(reply) == 4) {
+        pixmap = *static_cast<xcb_pixmap_t*>(xcb_get_property_value(reply));
+    }
+    free(reply);
+    return pixmap;
+}
+
+int main() {
+    std::string cache = "/tmp/ade-bench-" + std::to_string(getpid());
+    setenv("XDG_CACHE_HOME", cache.c_str(), 1);
+
+    const size_t width = 6000;
+    const size_t height = 4000;
+    std::mt19937 random(42);
+    std::vector<uint32_t> photo(width * height);
+    for (uint32_t& pixel: photo) {
+        pixel = random() & 0xffffff;
+    }
+    std::vector<size_t> thread_counts = {1};
+    if (std::thread::hardware_concurrency() > 1) {
+        thread_counts.push_back(std::thread::hardware_concurrency());
+    }
+
+    std::vector<samples_t> results;
+    const std::pair<const char*, simd_t> simds[] = {
+        {"scalar", simd_t::scalar}, {"sse2", simd_t::sse2}, {"avx2", simd_t::avx2},
+    };
+    std::vector<uint32_t> scaled;
+    for (const auto& [name, simd]: simds) {
+        if (simd > best_simd()) {
+            continue;
+        }
+        for (size_t threads: thread_counts) {
+            std::string suffix = std::string(" ") + name + ", " + std::to_string(threads) + " threads";
+            results.push_back(measure("fill 3840x2160 from 6000x4000" + suffix, 10, [&]() {
+                scaled = scale_to_fill(photo.data(), width, height, width, 3840, 2160, simd, threads);
+            }));
+        }
+    }
+
+    wallpaper_header_t header {};
+    std::memcpy(header.magic, wallpaper_header_t::expected, sizeof(header.magic));
+    header.width = 3840;
+    header.height = 2160;
+    std::string path = wallpaper_cache_path("bench", header.width, header.height);
+    results.push_back(measure("write 4k cache", 20, [&]() {
+        write_wallpaper_cache(path, header, scaled);
+    }));
+    // what the server does with it on a hit, short of copying it
+    results.push_back(measure("open and map 4k cache", 200, [&]() {
+        int fd = open_wallpaper_cache(path, header);
+        size_t size = sizeof(header) + scaled.size() * sizeof(uint32_t);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        close(fd);
+        munmap(mapped, size);
+    }));
+
+    if (std::getenv("DISPLAY")) {
+        display_t display;
+        const auto& c = display.connection.connection;
+        const xcb_window_t root = display.screen.screen->root;
+        // this replaces the root's background, so only where nothing else
+        // set one, as under xvfb-run, and the root is put back afterwards
+        if (root_pixmap(c, root)) {
+            std::cerr << "the root has a wallpaper already, skipping setting one" << std::endl;
+        } else {
+            std::string image = cache + "/photo.png";
+            cairo_surface_t* surface = cairo_image_surface_create_for_data(reinterpret_cast<unsigned char*>(photo.data()),
+                CAIRO_FORMAT_RGB24, width, height, width * sizeof(uint32_t));
+            cairo_surface_write_to_png(surface, image.c_str());
+            cairo_surface_destroy(surface);
+
+            reactor_t reactor;
+            wallpaper_t wallpaper{display.screen, reactor};
+            // until the worker is done and the reactor has published its pixmap
+            const auto set = [&]() {
+                wallpaper.set(image);
+                while (wallpaper.busy()) {
+                    reactor.step();
+                }
+                display.sync();
+            };
+            results.push_back(measure("set, cache missed", 5, [&]() {
+                std::filesystem::remove_all(cache + "/ade");
+                set();
+            }));
+            results.push_back(measure("set, cache hit", 50, set));
+
+            xcb_kill_client(c, root_pixmap(c, root));
+            xcb_delete_property(c, root, _XROOTPMAP_ID);
+            xcb_delete_property(c, root, ESETROOT_PMAP_ID);
+            // none on the root brings its default background back
+            uint32_t none = XCB_BACK_PIXMAP_NONE;
+            xcb_change_window_attributes(c, root, XCB_CW_BACK_PIXMAP, &none);
+            xcb_clear_area(c, false, root, 0, 0, 0, 0);
+            display.sync();
+        }
+    }
+    std::filesystem::remove_all(cache);
+
+    report("wallpaper", results);
+    return 0;
+}
@@ -6,10 +6,10 @@ brightness=25
 
 case ${1-none} in
     up)
-        xrandr --output eDP-1 --brightness $(awk "BEGIN { print ($brightness + 1) / 100 }")
+        xrandr --output eDP-1 --brightness $(awk "BEGIN { print ($brightness + ${2-1}) / 100 }")
         ;;
     down)
-        xrandr --output eDP-1 --brightness $(awk "BEGIN { print ($brightness - 1) / 100 }")
+        xrandr --output eDP-1 --brightness $(awk "BEGIN { print ($brightness - ${2-1}) / 100 }")
         ;;
     none)
         echo "brightness $brightness%"
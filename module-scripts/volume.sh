@@ -1,19 +1,29 @@
 set -euo pipefail
 
+show() {
+    if $(pamixer --get-mute); then
+        str="muted "
+    else
+        str="volume"
+    fi
+    echo "${str} $(pamixer --get-volume)%"
+}
+
 case ${1-default} in
     default)
-        if $(pamixer --get-mute); then
-            str="muted "
-        else
-            str="volume"
-        fi
-        echo "${str} $(pamixer --get-volume)%"
+        show
+        ;;
+    watch)
+        show
+        pactl subscribe | grep --line-buffered "on sink" | while read -r _; do
+            show
+        done
         ;;
     up)
-        pamixer --increase 1
+        pamixer --increase ${2-1}
         ;;
     down)
-        pamixer --decrease 1
+        pamixer --decrease ${2-1}
         ;;
     mute)
         pamixer --toggle-mute
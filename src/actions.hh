@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bar.hh"
+#include "process.hh"
+#include "reactor.hh"
+#include "scheduler.hh"
+
+const command_t& module_action(const module_t& module, uint8_t button) {
+    static const command_t none;
+    switch (button) {
+        case 1:
+            return module.left_click;
+        case 2:
+            return module.middle_click;
+        case 3:
+            return module.right_click;
+        case 4:
+            return module.wheel_up;
+        case 5:
+            return module.wheel_down;
+        default:
+            return none;
+    }
+}
+
+// launches click and wheel actions without waiting for them
+// wheel steps that arrive while the previous step is still running are
+// coalesced into one run with the step count appended, e.g. "volume.sh up 5"
+// once an action exits its module is refreshed through the scheduler
+struct actions_t {
+    struct pending_t {
+        bool running = false;
+        size_t count = 0;
+    };
+    // what an action that is still running reports back to when it exits
+    // module follows the module across reloads, and is npos once it is gone
+    struct target_t {
+        size_t module;
+        std::array<pending_t, 2> wheel;
+    };
+
+    content_t& content;
+    children_t& children;
+    scheduler_t& scheduler;
+    std::vector<std::shared_ptr<target_t>> targets;
+
+    actions_t(content_t& _content, children_t& _children, scheduler_t& _scheduler):
+        content(_content),
+        children(_children),
+        scheduler(_scheduler)
+    {
+        reload({});
+    }
+
+    // follows content.replace(), moved says where each old module went
+    void reload(const std::vector<size_t>& moved) {
+        std::vector<std::shared_ptr<target_t>> next(content.modules.size());
+        for (auto& target: targets) {
+            target->module = moved[target->module];
+            if (target->module != content_t::npos) {
+                next[target->module] = target;
+            }
+        }
+        for (size_t i = 0; i < next.size(); i++) {
+            if (!next[i]) {
+                next[i] = std::make_shared<target_t>(target_t{i, {}});
+            }
+        }
+        targets = std::move(next);
+    }
+
+    void click(size_t module, uint8_t button) {
+        const command_t& action = module_action(content.modules[module], button);
+        if (action.empty()) {
+            return;
+        }
+        if (button != 4 && button != 5) {
+            launch(targets[module], action);
+            return;
+        }
+        pending_t& p = targets[module]->wheel[button - 4];
+        p.count++;
+        if (!p.running) {
+            run(targets[module], button);
+        }
+    }
+
+private:
+    void launch(std::shared_ptr<target_t> target, const command_t& command) {
+        pid_t pid = spawn(command, nullptr, false);
+        if (pid == -1) {
+            return;
+        }
+        children.watch(pid, [this, target](int) {
+            if (target->module != content_t::npos) {
+                scheduler.refresh(target->module);
+            }
+        });
+    }
+
+    void run(std::shared_ptr<target_t> target, uint8_t button) {
+        pending_t& p = target->wheel[button - 4];
+        command_t command = module_action(content.modules[target->module], button);
+        if (p.count > 1) {
+            command = command.with_argument(std::to_string(p.count));
+        }
+        p.count = 0;
+        pid_t pid = spawn(command, nullptr, false);
+        if (pid == -1) {
+            p.running = false;
+            return;
+        }
+        p.running = true;
+        children.watch(pid, [this, target, button](int) {
+            pending_t& p = target->wheel[button - 4];
+            p.running = false;
+            if (target->module == content_t::npos) {
+                return;
+            }
+            if (p.count > 0 && !module_action(content.modules[target->module], button).empty()) {
+                run(target, button);
+            } else {
+                scheduler.refresh(target->module);
+            }
+        });
+    }
+};
@@ -1,113 +1,518 @@
-#include <thread>
+#include <algorithm>
 #include <string>
-#include <mutex>
-#include <condition_variable>
 #include <cmath>
-
-#include <toml.hpp>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
 
 #include "area.hh"
 #include "module.hh"
+#include "config.hh"
+#include "profile.hh"
 #include "render.hh"
+#include "text.hh"
 #include "bar.hh"
 #include "notifications.hh"
+#include "actions.hh"
+#include "apps.hh"
+#include "reactor.hh"
+#include "scheduler.hh"
+#include "stream.hh"
+#include "providers.hh"
+#include "watch.hh"
+#include "ipc.hh"
+#include "keys.hh"
+#include "launcher.hh"
+#include "lock.hh"
+#include "stats.hh"
+#include "wm.hh"
+#include "wallpaper.hh"
 
-int main() {
-    content_t content;
-    const auto data = toml::parse("config.toml");
-    const toml::array& modules_config = toml::find(data, "modules").as_array();
-    const auto separator = toml::find_or<std::string>(data, "separator", "");
-    for (const auto& module_config: modules_config) {
-        const auto gravity = toml::find_or<std::string>(module_config, "gravity", "left");
-        aabb_t::direction dir;
-        if (gravity == "left") {
-            dir = aabb_t::direction::left;
-        } else if (gravity == "right") {
-            dir = aabb_t::direction::right;
-        } else {
-            abort();
-        }
-        content.modules.emplace_back(module_t{
-            toml::find_or<std::string>(module_config, "exec", ""),
-            toml::find_or<std::string>(module_config, "text", ""),
-            {},
-            dir,
-            toml::find_or<std::string>(module_config, "left_click", ""),
-            toml::find_or<std::string>(module_config, "middle_click", ""),
-            toml::find_or<std::string>(module_config, "right_click", ""),
-            toml::find_or<std::string>(module_config, "wheel_up", ""),
-            toml::find_or<std::string>(module_config, "wheel_down", ""),
-        });
-        content.modules.emplace_back(module_t{
-            {}, separator, {}, dir, "", "", "", "", ""
-        });
-    }
+int main(int argc, char** argv) {
+    const bool profile_startup = argc > 1 && std::string(argv[1]) == "--profile-startup";
+    profile_t profile;
+
+    reactor_t reactor;
+    children_t children{reactor};
+    profile.mark("reactor");
+
+    // none of them needs the X server, so they happen while it is being connected to
+    struct loaded_t {
+        config_t config;
+        std::unique_ptr<text_cache_t> text;
+        std::unique_ptr<apps_t> apps;
+        profile_t profile;
+    };
+    auto loading = std::async(std::launch::async, [origin = profile.origin]() {
+        loaded_t loaded {{}, nullptr, nullptr, profile_t{origin}};
+        loaded.config = load_config("config.toml");
+        loaded.profile.mark("parse config (async)");
+        loaded.text = std::make_unique<text_cache_t>();
+        // the real size depends on the screen's dpi, but matching and loading
+        // the font is what takes the time
+        loaded.text->metrics(loaded.config.font, loaded.config.font_size);
+        loaded.profile.mark("load font (async)");
+        loaded.apps = std::make_unique<apps_t>();
+        loaded.profile.mark("map app index (async)");
+        return loaded;
+    });
+
+    // sends every request whose reply startup needs
     connection_t connection;
     screen_t screen{connection};
+    xcb_flush(connection.connection);
+    profile.mark("connect and send requests");
+
+    loaded_t loaded = loading.get();
+    config_t& config = loaded.config;
+    text_cache_t& text = *loaded.text;
+    apps_t& apps = *loaded.apps;
+    profile.merge(loaded.profile);
+    profile.mark("wait for config and font");
+
+    connection.collect();
+    screen.collect(connection);
+    profile.mark("collect replies");
+
+    content_t content;
+    content.modules = std::move(config.modules);
+    for (size_t i = 0; i < content.modules.size(); i++) {
+        content.publish(i, content.modules[i].text);
+    }
+
+    // where an output's bar and the notifications go, for a given line height
+    // the notifications go on the primary output, below its bar
+    const auto bar_area = [&](const output_t& output, int height) {
+        aabb_t area = output.aabb;
+        return area.chop(aabb_t::direction::top, height);
+    };
+    const auto notifications_area = [&](int height) {
+        auto primary = std::find_if(screen.outputs.begin(), screen.outputs.end(), [](const output_t& output) { return output.primary; });
+        aabb_t area = primary->aabb;
+        area.chop(aabb_t::direction::top, height);
+        return area.chop(aabb_t::direction::right, config.notification_width).chop(aabb_t::direction::top, config.notification_lines * height);
+    };
+    // the launcher goes across the primary output, below its bar
+    const auto launcher_area = [&](int height) {
+        auto primary = std::find_if(screen.outputs.begin(), screen.outputs.end(), [](const output_t& output) { return output.primary; });
+        aabb_t area = primary->aabb;
+        area.chop(aabb_t::direction::top, height);
+        return area.chop(aabb_t::direction::top, (config.launcher_lines + 1) * height);
+    };
+
+    double font_size = config.font_size * screen.dpi_y / 72.0;
+    int bar_height = std::ceil(text.metrics(config.font, font_size).height);
+    profile.mark("font metrics");
+
+    // one bar per output, keyed by output name; all of them draw the same
+    // modules, shaped once in the shared text cache
+    backend_t bar_backend = parse_backend(config.bar_backend);
+    std::map<std::string, std::unique_ptr<bar_t>> bars;
+    const auto add_bar = [&](const output_t& output) {
+        auto bar = std::make_unique<bar_t>(connection, screen, content, text, bar_area(output, bar_height), bar_backend);
+        bar->font = config.font;
+        bar->font_size = font_size;
+        bar->foreground = config.foreground;
+        bar->background = config.background;
+        return bar;
+    };
+    for (const output_t& output: screen.outputs) {
+        bars[output.name] = add_bar(output);
+    }
+
+    backend_t notifications_backend = parse_backend(config.notifications_backend);
+    notifications_t notifications{connection, screen, reactor, text, notifications_area(bar_height), config.notification_lines, config.notification_columns, notifications_backend};
+    notifications.font = config.font;
+    notifications.font_size = font_size;
+    notifications.line_height = bar_height;
+    notifications.foreground = config.foreground;
+    notifications.background = config.background;
+    notifications.timeout = config.notification_timeout;
+    profile.mark("create windows");
+
+    // what each output has left below its bar, for tiling windows into,
+    // by output name
+    const auto tiling_areas = [&]() {
+        std::map<std::string, aabb_t> areas;
+        for (const output_t& output: screen.outputs) {
+            aabb_t area = output.aabb;
+            area.chop(aabb_t::direction::top, bar_height);
+            areas[output.name] = area;
+        }
+        return areas;
+    };
+    std::unique_ptr<wm_t> wm;
+    if (config.window_manager) {
+        wm = std::make_unique<wm_t>(connection, screen, tiling_areas());
+    }
+    profile.mark("window manager");
+
+    keys_t keys{connection, screen, config.bindings};
+    profile.mark("grab keys");
+
+    launcher_t launcher{connection, screen, reactor, text, apps, keys.keymap, launcher_area(bar_height), config.launcher_lines, parse_backend(config.launcher_backend)};
+    launcher.font = config.font;
+    launcher.font_size = font_size;
+    launcher.line_height = bar_height;
+    launcher.foreground = config.foreground;
+    launcher.background = config.background;
+    apps.on_rebuilt = [&]() { launcher.refresh(); };
+    apps.watch(reactor);
+    profile.mark("launcher");
+
+    lock_t lock{connection, screen, reactor, text, keys.keymap};
+    lock.radius = config.lock_blur_radius;
+    lock.pam_service = config.lock_pam_service;
+    lock.font = config.font;
+    lock.font_size = font_size;
+    lock.line_height = bar_height;
+    lock.foreground = config.foreground;
+    lock.background = config.background;
+    const auto open_launcher = [&]() {
+        if (!lock.locked) {
+            launcher.open();
+        }
+    };
+    const auto lock_screen = [&]() {
+        launcher.close();
+        lock.lock();
+    };
+    keys.actions["launcher"] = open_launcher;
+    keys.actions["lock"] = lock_screen;
+    profile.mark("lock");
+
+    // decodes and scales, off the reactor's thread, only when the cache in
+    // $XDG_CACHE_HOME/ade misses
+    wallpaper_t wallpaper{screen, reactor};
+    wallpaper.set(config.wallpaper);
+    profile.mark("wallpaper");
+
+    std::unique_ptr<notification_server_t> notification_server;
+    try {
+        notification_server = std::make_unique<notification_server_t>(reactor, notifications);
+    } catch (const sdbus::Error& e) {
+        std::cout << "notification server failed! " << e.getMessage() << std::endl;
+    }
+    profile.mark("notification server");
+
+    reactor.slack = config.timer_slack;
+    scheduler_t scheduler{content, reactor, children, config.workers};
+    streams_t streams{content, reactor, children};
+    providers_t providers{content, reactor};
+    actions_t actions{content, children, scheduler};
+    profile.mark("start modules");
+
+    // polling stops while nothing of the bars can be seen: the screen saver
+    // is on, which dpms turning the screen off also switches on, or every
+    // bar is fully covered; modules that came due meanwhile run once on resume
+    const xcb_query_extension_reply_t* saver = xcb_get_extension_data(connection.connection, &xcb_screensaver_id);
+    uint8_t saver_event = 0;
+    if (saver && saver->present) {
+        saver_event = saver->first_event;
+        xcb_screensaver_select_input(connection.connection, screen.screen->root, XCB_SCREENSAVER_EVENT_NOTIFY_MASK);
+    }
+    bool saver_on = false;
+    bool hidden = false;
+    const auto update_hidden = [&]() {
+        bool obscured = std::all_of(bars.begin(), bars.end(), [](const auto& bar) { return bar.second->obscured; });
+        bool next = config.pause_when_hidden && (saver_on || obscured);
+        if (next == hidden) {
+            return;
+        }
+        hidden = next;
+        if (hidden) {
+            scheduler.pause();
+            providers.pause();
+        } else {
+            scheduler.resume();
+            providers.resume();
+        }
+    };
+
+    // applies only what changed: modules that still get their output from the
+    // same place keep running and keep it, text is only shaped again for a
+    // new font, and windows are only resized if the line height changed
+    // backends and the number of notification lines and columns still need a restart
+    file_watch_t config_watch{reactor, "config.toml", [&]() {
+        config_t next;
+        try {
+            next = load_config("config.toml");
+        } catch (const std::exception& e) {
+            std::cout << "config reload failed! " << e.what() << std::endl;
+            return;
+        }
+        std::vector<size_t> moved = content.replace(std::move(next.modules));
+        scheduler.max_jobs = std::max<size_t>(1, next.workers);
+        scheduler.reload(moved);
+        streams.reload(moved);
+        providers.reload(moved);
+        actions.reload(moved);
+        keys.reload(std::move(next.bindings));
+        for (auto& [name, bar]: bars) {
+            bar->reload();
+        }
 
-    std::string font = toml::find<std::string>(data, "font");
-    double font_size = toml::find<float>(data, "font_size") * screen.dpi_y / 72.0;
-    auto font_extents = calculate_font_extents(font, font_size);
-    int bar_height = std::ceil(font_extents.height);
-    aabb_t bar_aabb = screen.aabb.chop(aabb_t::direction::top, bar_height);
-
-    bar_t bar{connection, screen, content, bar_aabb};
-    bar.font = font;
-    bar.font_size = font_size;
-    bar.foreground = toml::find<std::array<float, 3>>(data, "foreground");
-    bar.background = toml::find<std::array<float, 3>>(data, "background");
-
-    int notif_width = 200;
-    aabb_t notifications_aabb = screen.aabb.chop(aabb_t::direction::right, notif_width);
-    size_t notification_lines = 4;
-    size_t notification_columns = 40;
-    notifications_t notifications{connection, screen, notifications_aabb, notification_lines, notification_columns};
-
-    std::mutex content_lock;
-    std::condition_variable render_notify;
-
-    std::thread events_thread([&]() {
-        while (true) {
-            module_t* section = bar.handle_events();
-            if (section) {
-                {
-                    std::lock_guard<std::mutex> l(content_lock);
-                    section->content = exec(section->exec);
+        bool restyled =
+            next.font != config.font ||
+            next.font_size != config.font_size ||
+            next.foreground != config.foreground ||
+            next.background != config.background ||
+            next.notification_width != config.notification_width ||
+            next.launcher_lines != config.launcher_lines;
+        next.bar_backend = config.bar_backend;
+        next.notifications_backend = config.notifications_backend;
+        next.launcher_backend = config.launcher_backend;
+        next.notification_lines = config.notification_lines;
+        next.notification_columns = config.notification_columns;
+        next.window_manager = config.window_manager;
+        config = std::move(next);
+        lock.radius = config.lock_blur_radius;
+        lock.pam_service = config.lock_pam_service;
+        if (config.wallpaper != wallpaper.image) {
+            wallpaper.set(config.wallpaper);
+        }
+        notifications.timeout = config.notification_timeout;
+        reactor.slack = config.timer_slack;
+        update_hidden();
+        if (stats.trace.events.size() != config.trace_events) {
+            stats.trace.enable(config.trace_events);
+        }
+        if (restyled) {
+            font_size = config.font_size * screen.dpi_y / 72.0;
+            int height = std::ceil(text.metrics(config.font, font_size).height);
+            bool resized = height != bar_height;
+            bar_height = height;
+            for (const output_t& output: screen.outputs) {
+                bar_t& bar = *bars[output.name];
+                bar.font = config.font;
+                bar.font_size = font_size;
+                bar.foreground = config.foreground;
+                bar.background = config.background;
+                if (resized) {
+                    bar.resize(bar_area(output, bar_height));
                 }
-                render_notify.notify_one();
+            }
+            notifications.font = config.font;
+            notifications.font_size = font_size;
+            notifications.foreground = config.foreground;
+            notifications.background = config.background;
+            notifications.line_height = bar_height;
+            notifications.restyle(notifications_area(bar_height));
+            launcher.font = config.font;
+            launcher.font_size = font_size;
+            launcher.foreground = config.foreground;
+            launcher.background = config.background;
+            launcher.line_height = bar_height;
+            launcher.lines = config.launcher_lines;
+            launcher.restyle(launcher_area(bar_height));
+            lock.font = config.font;
+            lock.font_size = font_size;
+            lock.foreground = config.foreground;
+            lock.background = config.background;
+            lock.line_height = bar_height;
+            if (wm && resized) {
+                wm->set_areas(tiling_areas());
+                wm->flush();
             }
         }
-    });
+        reactor.request_frame();
+    }};
+
+    // `stats` answers with histograms of where the time goes, `trace` with
+    // the latest spans for chrome://tracing or perfetto
+    stats.trace.enable(config.trace_events);
+    stats.gauges = {
+        {"text_cache_hits", [&]() { return static_cast<double>(text.hits); }},
+        {"text_cache_misses", [&]() { return static_cast<double>(text.misses); }},
+        {"text_cache_hit_rate", [&]() { return text.hits + text.misses ? static_cast<double>(text.hits) / (text.hits + text.misses) : 0.0; }},
+        {"jobs_running", [&]() { return static_cast<double>(scheduler.running); }},
+        {"jobs_waiting", [&]() { return static_cast<double>(scheduler.waiting.size()); }},
+        {"notifications", [&]() { return static_cast<double>(notifications.ring.size()); }},
+        {"paused", [&]() { return hidden ? 1.0 : 0.0; }},
+        {"windows", [&]() { return wm ? static_cast<double>(wm->cells.size()) : 0.0; }},
+        {"apps", [&]() { return static_cast<double>(apps.index.count); }},
+        {"wallpaper_cache_hits", [&]() { return static_cast<double>(wallpaper.hits); }},
+        {"wallpaper_cache_misses", [&]() { return static_cast<double>(wallpaper.misses); }},
+    };
+    ipc_t ipc{reactor};
+    ipc.commands["stats"] = [](std::string_view) { return stats.json(); };
+    ipc.commands["trace"] = [](std::string_view) { return stats.trace.json(); };
+    ipc.commands["launcher"] = [&](std::string_view) -> std::string {
+        open_launcher();
+        return "ok\n";
+    };
+    ipc.commands["lock"] = [&](std::string_view) -> std::string {
+        lock_screen();
+        return "ok\n";
+    };
 
-    std::thread update_thread([&]() {
-        while (true) {
-            auto t = std::chrono::system_clock::now();
-            {
-                std::lock_guard<std::mutex> l(content_lock);
-                for (auto& module: content.modules) {
-                    if (!module.exec.empty()) {
-                        module.content = exec(module.exec);
-                    }
+    // lets other programs push a module's output instead of it being polled,
+    // or have a module run right away, by the module's `name`, e.g.
+    //     echo "set volume 42%" | socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/ade.sock
+    // everything pushed before the next frame is drawn in that one frame
+    const auto named = [&](std::string_view name) {
+        std::vector<size_t> found;
+        for (size_t i = 0; i < content.modules.size(); i++) {
+            if (!name.empty() && content.modules[i].name == name) {
+                found.push_back(i);
+            }
+        }
+        return found;
+    };
+    ipc.commands["set"] = [&](std::string_view args) -> std::string {
+        auto [name, value] = ipc_t::split(args);
+        std::vector<size_t> found = named(name);
+        if (found.empty()) {
+            return "unknown module " + std::string(name) + "\n";
+        }
+        for (size_t i: found) {
+            if (content.publish(i, value)) {
+                reactor.request_frame();
+            }
+        }
+        return "ok\n";
+    };
+    ipc.commands["refresh"] = [&](std::string_view name) -> std::string {
+        std::vector<size_t> found = named(name);
+        if (found.empty()) {
+            return "unknown module " + std::string(name) + "\n";
+        }
+        for (size_t i: found) {
+            scheduler.refresh(i);
+            providers.refresh(i);
+        }
+        return "ok\n";
+    };
+
+    // monitors coming, going or moving only touch the bars of the outputs
+    // that changed; modules keep running and layouts stay cached throughout
+    const auto& c = connection.connection;
+    const auto update_outputs = [&]() {
+        screen.request_outputs(connection);
+        screen.collect_outputs(connection);
+        std::map<std::string, std::unique_ptr<bar_t>> next;
+        for (const output_t& output: screen.outputs) {
+            auto it = bars.find(output.name);
+            if (it == bars.end()) {
+                next[output.name] = add_bar(output);
+                continue;
+            }
+            aabb_t area = bar_area(output, bar_height);
+            if (it->second->window.aabb != area) {
+                it->second->resize(area);
+            }
+            next[output.name] = std::move(it->second);
+        }
+        // whatever is left in bars was unplugged and is destroyed here
+        bars = std::move(next);
+        if (wm) {
+            wm->set_areas(tiling_areas());
+            wm->flush();
+        }
+        aabb_t area = notifications_area(bar_height);
+        if (notifications.window.aabb != area) {
+            notifications.restyle(area);
+        }
+        area = launcher_area(bar_height);
+        if (launcher.window.aabb != area) {
+            launcher.restyle(area);
+        }
+        if (lock.window.aabb != screen.aabb) {
+            lock.resize(screen.aabb);
+        }
+        wallpaper.update();
+        reactor.request_frame();
+    };
+    if (screen.randr_event) {
+        xcb_randr_select_input(c, screen.screen->root, XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE);
+    }
+
+    const auto handle_x = [&]() {
+        if (xcb_connection_has_error(c)) {
+            std::cout << "lost the X connection" << std::endl;
+            exit(1);
+        }
+        uint64_t events = 0;
+        // a single change usually arrives as a burst of notifications
+        bool screen_changed = false;
+        while (xcb_generic_event_t* event = xcb_poll_for_event(c)) {
+            events++;
+            if (screen.randr_event && (event->response_type & ~0x80) == screen.randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+                screen_changed = true;
+                free(event);
+                continue;
+            }
+            if (saver_event && (event->response_type & ~0x80) == saver_event + XCB_SCREENSAVER_NOTIFY) {
+                uint8_t state = reinterpret_cast<xcb_screensaver_notify_event_t*>(event)->state;
+                saver_on = state == XCB_SCREENSAVER_STATE_ON || state == XCB_SCREENSAVER_STATE_CYCLE;
+                free(event);
+                continue;
+            }
+            // while they are open, the lock and the launcher take every key press
+            if (lock.handle_event(event) || launcher.handle_event(event) || keys.handle_event(event)) {
+                free(event);
+                continue;
+            }
+            if (wm && wm->handle_event(event)) {
+                free(event);
+                continue;
+            }
+            event_result_t result;
+            for (auto& [name, bar]: bars) {
+                event_result_t bar_result = bar->handle_event(event);
+                if (bar_result.clicked) {
+                    actions.click(bar_result.clicked - content.modules.data(), bar_result.button);
                 }
+                result.damaged = result.damaged || bar_result.damaged;
+            }
+            if (notifications.handle_event(event)) {
+                result.damaged = true;
             }
-            render_notify.notify_one();
-            using namespace std::literals::chrono_literals;
-            std::this_thread::sleep_until(t + 1s);
+            if (result.damaged) {
+                reactor.request_frame();
+            }
+            free(event);
+        }
+        if (events > 0) {
+            stats.x_events.add(events);
+        }
+        // everything the burst changed goes out as one batch of requests
+        if (wm) {
+            wm->flush();
         }
+        if (screen_changed) {
+            update_outputs();
+        }
+        update_hidden();
+    };
+    reactor.add(xcb_get_file_descriptor(c), [&](uint32_t) { handle_x(); });
+    // replies read while rendering can leave events queued without the fd becoming readable
+    reactor.add_idle([&]() {
+        handle_x();
+        xcb_flush(c);
     });
-
-    std::thread render_thread([&]() {
-        while (true) {
-            std::unique_lock<std::mutex> l(content_lock);
-            render_notify.wait(l);
-            // bar.redraw();
+    reactor.on_frame = [&]() {
+        for (auto& [name, bar]: bars) {
+            bar->redraw();
+        }
+        // nothing new may be mapped above the lock, it waits for the unlock
+        if (!lock.locked) {
             notifications.redraw();
         }
-    });
-
-    events_thread.join();
-    update_thread.join();
-    render_thread.join();
+        launcher.redraw();
+        lock.redraw();
+        if (profile_startup) {
+            // waits until the server has drawn the first frame too
+            free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), nullptr));
+            profile.mark("first frame");
+            profile.print();
+            exit(0);
+        }
+    };
+    reactor.request_frame();
+    reactor.run();
 
     return 0;
 }
@@ -0,0 +1,544 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fuzzy.hh"
+#include "reactor.hh"
+#include "watch.hh"
+
+// something the launcher can run: an executable on $PATH, or an
+// application's .desktop entry
+struct app_t {
+    std::string name;
+    std::string exec;
+};
+
+std::vector<std::string> split_paths(const std::string& list) {
+    std::vector<std::string> paths;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(':', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > begin) {
+            paths.push_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return paths;
+}
+
+std::string env_or(const char* name, const std::string& fallback) {
+    const char* value = std::getenv(name);
+    return value && *value ? value : fallback;
+}
+
+std::vector<std::string> path_dirs() {
+    return split_paths(env_or("PATH", "/usr/local/bin:/usr/bin:/bin"));
+}
+
+// $XDG_DATA_HOME first, so a user's own entries hide the system's
+std::vector<std::string> desktop_dirs() {
+    std::string home = env_or("HOME", "/");
+    std::vector<std::string> dirs = {env_or("XDG_DATA_HOME", home + "/.local/share") + "/applications"};
+    for (const auto& dir: split_paths(env_or("XDG_DATA_DIRS", "/usr/local/share:/usr/share"))) {
+        dirs.push_back(dir + "/applications");
+    }
+    return dirs;
+}
+
+// $XDG_CACHE_HOME/ade/apps.index
+std::string app_index_path() {
+    return env_or("XDG_CACHE_HOME", env_or("HOME", "/tmp") + "/.cache") + "/ade/apps.index";
+}
+
+// drops %f, %U and the like, which only make sense when opening files
+std::string strip_field_codes(const std::string& exec) {
+    std::string out;
+    for (size_t i = 0; i < exec.size(); i++) {
+        if (exec[i] != '%' || i + 1 == exec.size()) {
+            out += exec[i];
+        } else if (exec[++i] == '%') {
+            out += '%';
+        }
+    }
+    while (!out.empty() && out.back() == ' ') {
+        out.pop_back();
+    }
+    return out;
+}
+
+// only the [Desktop Entry] group, and only applications that want to be shown
+std::optional<app_t> parse_desktop_entry(const std::string& path) {
+    std::ifstream file(path);
+    std::string line;
+    std::string group;
+    std::string type;
+    app_t app;
+    bool hidden = false;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.front() == '[') {
+            group = line;
+            continue;
+        }
+        if (group != "[Desktop Entry]") {
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        if (key == "Name") {
+            app.name = value;
+        } else if (key == "Exec") {
+            app.exec = strip_field_codes(value);
+        } else if (key == "Type") {
+            type = value;
+        } else if ((key == "NoDisplay" || key == "Hidden") && value == "true") {
+            hidden = true;
+        }
+    }
+    if (hidden || type != "Application" || app.name.empty() || app.exec.empty()) {
+        return std::nullopt;
+    }
+    return app;
+}
+
+// executables in earlier $PATH directories hide later ones of the same
+// name, as they would in a shell, and likewise for .desktop files
+std::vector<app_t> scan_apps(const std::vector<std::string>& path, const std::vector<std::string>& desktop) {
+    std::vector<app_t> apps;
+    std::unordered_set<std::string> seen;
+    for (const auto& dir: path) {
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            continue;
+        }
+        int fd = dirfd(d);
+        while (dirent* entry = readdir(d)) {
+            if (entry->d_name[0] == '.' || seen.count(entry->d_name)) {
+                continue;
+            }
+            struct stat st;
+            if (fstatat(fd, entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) && faccessat(fd, entry->d_name, X_OK, 0) == 0) {
+                seen.insert(entry->d_name);
+                apps.push_back(app_t{entry->d_name, entry->d_name});
+            }
+        }
+        closedir(d);
+    }
+    seen.clear();
+    for (const auto& dir: desktop) {
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            continue;
+        }
+        while (dirent* entry = readdir(d)) {
+            std::string_view name = entry->d_name;
+            if (name.size() <= 8 || name.substr(name.size() - 8) != ".desktop" || !seen.insert(entry->d_name).second) {
+                continue;
+            }
+            if (auto app = parse_desktop_entry(dir + "/" + entry->d_name)) {
+                apps.push_back(std::move(*app));
+            }
+        }
+        closedir(d);
+    }
+    return apps;
+}
+
+// the newest modification time of any of the directories, which changes
+// whenever something in them is added, removed or renamed
+uint64_t dirs_stamp(const std::vector<std::string>& dirs) {
+    uint64_t stamp = 0;
+    for (const auto& dir: dirs) {
+        struct stat st;
+        if (stat(dir.c_str(), &st) == 0) {
+            stamp = std::max<uint64_t>(stamp, static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec);
+        }
+    }
+    return stamp;
+}
+
+// fnv-1a of the directory list, so a different $PATH builds a new index
+uint64_t dirs_hash(const std::vector<std::string>& dirs) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const auto& dir: dirs) {
+        for (char c: dir + ":") {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+// the apps as a file that is used straight from an mmap:
+//     header, 64 bytes
+//     one char_mask() per name, padded to 16 bytes, for the prefilter
+//     one entry per app, offsets into the strings
+//     the strings
+// sorted by name, so an empty query lists apps alphabetically
+struct app_index_t {
+    struct header_t {
+        char magic[8];
+        // dirs_stamp() and dirs_hash() of what it was built from
+        uint64_t stamp;
+        uint64_t dirs;
+        uint32_t count;
+        uint32_t strings;
+        uint8_t padding[32];
+    };
+    struct entry_t {
+        uint32_t name;
+        uint32_t name_length;
+        uint32_t exec;
+        uint32_t exec_length;
+    };
+    static constexpr char magic[8] = {'a', 'd', 'e', 'a', 'p', 'p', 's', '1'};
+
+    const char* data = nullptr;
+    size_t size = 0;
+    const header_t* header = nullptr;
+    const uint32_t* masks = nullptr;
+    const entry_t* entries = nullptr;
+    const char* strings = nullptr;
+    size_t count = 0;
+    // bumped on every map, so searches know their indices went stale
+    uint64_t generation = 0;
+
+    app_index_t() {}
+    ~app_index_t() {
+        unmap();
+    }
+    app_index_t(const app_index_t&) = delete;
+    app_index_t& operator=(const app_index_t&) = delete;
+
+    std::string_view name(size_t i) const {
+        return std::string_view(strings + entries[i].name, entries[i].name_length);
+    }
+    std::string_view exec(size_t i) const {
+        return std::string_view(strings + entries[i].exec, entries[i].exec_length);
+    }
+
+    static size_t masks_size(size_t count) {
+        return (count * sizeof(uint32_t) + 15) / 16 * 16;
+    }
+
+    // written next to the index and renamed over it, so a running ade
+    // never maps a half written file
+    static bool write(const std::string& path, std::vector<app_t> apps, uint64_t stamp, uint64_t dirs) {
+        std::sort(apps.begin(), apps.end(), [](const app_t& a, const app_t& b) {
+            return std::tie(a.name, a.exec) < std::tie(b.name, b.exec);
+        });
+        header_t header {};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.stamp = stamp;
+        header.dirs = dirs;
+        header.count = apps.size();
+        std::vector<uint32_t> masks(masks_size(apps.size()) / sizeof(uint32_t));
+        std::vector<entry_t> entries;
+        std::string strings;
+        for (size_t i = 0; i < apps.size(); i++) {
+            masks[i] = mask_of(apps[i].name);
+            entries.push_back(entry_t{
+                static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(apps[i].name.size()),
+                static_cast<uint32_t>(strings.size() + apps[i].name.size()), static_cast<uint32_t>(apps[i].exec.size()),
+            });
+            strings += apps[i].name;
+            strings += apps[i].exec;
+        }
+        header.strings = strings.size();
+
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        std::string temporary = path + ".tmp";
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(masks.data()), masks.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(entry_t));
+        file.write(strings.data(), strings.size());
+        file.close();
+        if (!file || std::rename(temporary.c_str(), path.c_str()) == -1) {
+            std::cout << "writing " << path << " failed!" << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // returns false, leaving nothing mapped, if the file is missing or broken
+    bool map(const std::string& path) {
+        unmap();
+        generation++;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat st;
+        void* mapped = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(header_t)) {
+            mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<const char*>(mapped);
+        size = st.st_size;
+        header = reinterpret_cast<const header_t*>(data);
+        if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 ||
+            size != sizeof(header_t) + masks_size(header->count) + header->count * sizeof(entry_t) + header->strings) {
+            unmap();
+            return false;
+        }
+        count = header->count;
+        masks = reinterpret_cast<const uint32_t*>(data + sizeof(header_t));
+        entries = reinterpret_cast<const entry_t*>(data + sizeof(header_t) + masks_size(count));
+        strings = reinterpret_cast<const char*>(entries + count);
+        for (size_t i = 0; i < count; i++) {
+            const entry_t& e = entries[i];
+            if (uint64_t(e.name) + e.name_length > header->strings || uint64_t(e.exec) + e.exec_length > header->strings) {
+                unmap();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+        data = nullptr;
+        size = 0;
+        header = nullptr;
+        masks = nullptr;
+        entries = nullptr;
+        strings = nullptr;
+        count = 0;
+    }
+};
+
+// the index of $PATH and the .desktop directories: mapped as is when none
+// of the directories changed since it was built, and otherwise built again,
+// which once watch() is called also happens whenever inotify sees them change
+// doesn't touch the reactor until then, so it can be loaded on another thread
+// rebuilds after a change are scanned and written on a thread of their own,
+// as during a package upgrade that takes long enough to stall the bar, and
+// only the new file is mapped on the reactor's thread
+struct apps_t {
+    std::string path;
+    std::vector<std::string> path_dirs;
+    std::vector<std::string> desktop_dirs;
+    app_index_t index;
+    std::function<void()> on_rebuilt;
+    std::unique_ptr<dir_watch_t> watcher;
+    reactor_t* reactor = nullptr;
+    std::thread builder;
+    int built = -1;
+    // the directories changed again while the builder was busy
+    bool again = false;
+
+    apps_t(std::string _path = app_index_path()):
+        path(std::move(_path)),
+        path_dirs(::path_dirs()),
+        desktop_dirs(::desktop_dirs())
+    {
+        std::vector<std::string> all = dirs();
+        if (!index.map(path) || index.header->stamp != dirs_stamp(all) || index.header->dirs != dirs_hash(all)) {
+            rebuild();
+        }
+    }
+    ~apps_t() {
+        if (builder.joinable()) {
+            builder.join();
+        }
+        if (built != -1) {
+            reactor->remove(built);
+            close(built);
+        }
+    }
+    apps_t(const apps_t&) = delete;
+    apps_t& operator=(const apps_t&) = delete;
+
+    void watch(reactor_t& _reactor) {
+        reactor = &_reactor;
+        built = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        reactor->add(built, [this](uint32_t) { finished(); });
+        watcher = std::make_unique<dir_watch_t>(*reactor, dirs(), [this]() {
+            if (builder.joinable()) {
+                again = true;
+                return;
+            }
+            start();
+        });
+    }
+
+    std::vector<std::string> dirs() const {
+        std::vector<std::string> all = path_dirs;
+        all.insert(all.end(), desktop_dirs.begin(), desktop_dirs.end());
+        return all;
+    }
+
+    // the stamp is taken before scanning, so anything that changes during
+    // the scan makes the next startup build again
+    void rebuild() {
+        build();
+        remap();
+    }
+
+private:
+    void build() const {
+        std::vector<std::string> all = dirs();
+        uint64_t stamp = dirs_stamp(all);
+        app_index_t::write(path, scan_apps(path_dirs, desktop_dirs), stamp, dirs_hash(all));
+    }
+
+    void remap() {
+        if (!index.map(path)) {
+            std::cout << "mapping " << path << " failed!" << std::endl;
+        }
+    }
+
+    // the builder only reads what doesn't change after construction, and
+    // writes the file, which the reactor's thread maps once it is told
+    void start() {
+        builder = std::thread([this]() {
+            build();
+            uint64_t one = 1;
+            (void) !write(built, &one, sizeof(one));
+        });
+    }
+
+    void finished() {
+        uint64_t count;
+        while (read(built, &count, sizeof(count)) > 0) {}
+        if (!builder.joinable()) {
+            return;
+        }
+        builder.join();
+        remap();
+        if (on_rebuilt) {
+            on_rebuilt();
+        }
+        if (again) {
+            again = false;
+            start();
+        }
+    }
+};
+
+struct match_t {
+    uint32_t entry;
+    int32_t score;
+};
+
+// filters an index as a query is typed: each query only looks at what
+// matched the longest earlier query that is a prefix of it, so typing
+// another character narrows the last candidates rather than the whole
+// index, and deleting one goes back to candidates kept from before
+// only a query with no such earlier query goes through the simd prefilter
+struct search_t {
+    const app_index_t& index;
+    uint64_t generation = 0;
+    std::string query;
+    // candidates for each earlier query, by its length, shortest first;
+    // every one is a prefix of query
+    std::vector<std::pair<size_t, std::vector<match_t>>> levels;
+    std::vector<uint32_t> prefiltered;
+    simd_t simd = best_simd();
+
+    search_t(const app_index_t& _index): index(_index) {}
+
+    void set(std::string_view next) {
+        if (generation != index.generation) {
+            generation = index.generation;
+            levels.clear();
+            query.clear();
+        }
+        size_t common = 0;
+        while (common < query.size() && common < next.size() && query[common] == next[common]) {
+            common++;
+        }
+        while (!levels.empty() && levels.back().first > common) {
+            levels.pop_back();
+        }
+        query = next;
+        if (query.empty() || (!levels.empty() && levels.back().first == query.size())) {
+            return;
+        }
+        uint32_t want = mask_of(query);
+        std::vector<match_t> matches;
+        const auto score = [&](uint32_t entry) {
+            int s = fuzzy_score(index.name(entry), query, simd);
+            if (s >= 0) {
+                matches.push_back(match_t{entry, s});
+            }
+        };
+        if (levels.empty()) {
+            prefiltered.clear();
+            prefilter(index.masks, index.count, want, prefiltered, simd);
+            for (uint32_t entry: prefiltered) {
+                score(entry);
+            }
+        } else {
+            for (const match_t& match: levels.back().second) {
+                if ((index.masks[match.entry] & want) == want) {
+                    score(match.entry);
+                }
+            }
+        }
+        levels.emplace_back(query.size(), std::move(matches));
+    }
+
+    size_t size() const {
+        return query.empty() || levels.empty() ? index.count : levels.back().second.size();
+    }
+
+    // the best n, best score first, then shorter names, then by name
+    std::vector<match_t> top(size_t n) const {
+        std::vector<match_t> best;
+        if (query.empty() || levels.empty()) {
+            for (size_t i = 0; i < std::min(n, index.count); i++) {
+                best.push_back(match_t{static_cast<uint32_t>(i), 0});
+            }
+            return best;
+        }
+        const auto& matches = levels.back().second;
+        best.resize(std::min(n, matches.size()));
+        std::partial_sort_copy(matches.begin(), matches.end(), best.begin(), best.end(), [&](const match_t& a, const match_t& b) {
+            if (a.score != b.score) {
+                return a.score > b.score;
+            }
+            if (index.entries[a.entry].name_length != index.entries[b.entry].name_length) {
+                return index.entries[a.entry].name_length < index.entries[b.entry].name_length;
+            }
+            return a.entry < b.entry;
+        });
+        return best;
+    }
+};
@@ -1,4 +1,8 @@
+#pragma once
+
 #include <cassert>
+#include <cstddef>
+#include <ostream>
 
 struct aabb_t {
     int x0, y0, x1, y1;
@@ -24,6 +28,13 @@ struct aabb_t {
         return y1 - y0;
     }
 
+    bool operator==(const aabb_t& x) const {
+        return x0 == x.x0 && y0 == x.y0 && x1 == x.x1 && y1 == x.y1;
+    }
+    bool operator!=(const aabb_t& x) const {
+        return !(*this == x);
+    }
+
     friend std::ostream& operator<<(std::ostream& out, aabb_t x) {
         out << x.x0 << ", ";
         out << x.y0 << ", ";
@@ -87,10 +87,15 @@ std::vector<cached_atom> cached_atoms = {
     {"WM_HINTS", &WM_HINTS},
 };
 
-void cache_atoms(xcb_connection_t* connection) {
+// only sends the requests, so the replies can be collected once something
+// else has been done in the meantime
+void request_atoms(xcb_connection_t* connection) {
     for (auto& cached_atom: cached_atoms) {
         cached_atom.cookie = xcb_intern_atom(connection, false, cached_atom.name.length(), cached_atom.name.c_str());
     }
+}
+
+void collect_atoms(xcb_connection_t* connection) {
     for (auto& cached_atom: cached_atoms) {
         xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(connection, cached_atom.cookie, nullptr);
         if (reply) {
@@ -2,61 +2,137 @@
 
 #include <algorithm>
 #include <iostream>
+#include <cmath>
 #include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 #include <unistd.h>
 
-#include "cairomm/fontface.h"
-#include "cairomm/types.h"
 #include "render.hh"
+#include "text.hh"
+#include "module.hh"
+#include "process.hh"
+#include "stats.hh"
 
 struct content_t {
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
     std::vector<module_t> modules;
-};
+    // bumped along with every module version, so a renderer can tell at a
+    // glance that nothing at all changed
+    uint64_t version = 0;
 
-void exec_nocapture(std::string cmd) {
-    system(cmd.c_str());
-}
-std::string exec(std::string cmd) {
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
-        std::cout << "popen() failed!" << std::endl;
-        exit(1);
+    // replaces a module's output with a new immutable snapshot
+    // returns false, keeping the old snapshot and version, if nothing changed
+    // for a module with a format, text is read as fields first
+    bool publish(size_t i, std::string_view text) {
+        if (modules[i].formatter) {
+            return publish(i, parse_fields(text));
+        }
+        return store(i, text);
     }
-    std::string result;
-    std::array<char, 128> buffer;
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        result += buffer.data();
+    // only the slots whose field changed are formatted again
+    bool publish(size_t i, const fields_t& fields) {
+        module_t& module = modules[i];
+        if (!module.formatter) {
+            return false;
+        }
+        if (!module.formatter->set(fields) && module.content) {
+            return false;
+        }
+        return store(i, module.formatter->render());
     }
-    if (pclose(pipe) == -1) {
-        std::cout << "pclose() failed!" << std::endl;
-        exit(1);
+
+    // swaps in a new set of modules, carrying over the output of every module
+    // that still gets it from the same place
+    // returns where each old module went, or npos if it is gone
+    std::vector<size_t> replace(std::vector<module_t> next) {
+        std::vector<size_t> moved(modules.size(), npos);
+        for (size_t i = 0; i < next.size(); i++) {
+            for (size_t j = 0; j < modules.size(); j++) {
+                if (moved[j] == npos && same_source(modules[j], next[i])) {
+                    moved[j] = i;
+                    next[i].version = modules[j].version;
+                    // a new format shows the text until the next output
+                    if (same_format(modules[j], next[i])) {
+                        next[i].content = modules[j].content;
+                        next[i].formatter = modules[j].formatter;
+                    }
+                    break;
+                }
+            }
+        }
+        modules = std::move(next);
+        version++;
+        for (size_t i = 0; i < modules.size(); i++) {
+            if (!modules[i].content) {
+                publish(i, modules[i].text);
+            }
+        }
+        return moved;
     }
-    std::replace(result.begin(), result.end(), '\n', ' ');
-    if (result.back() == ' ') {
-        result.pop_back();
+
+private:
+    bool store(size_t i, std::string_view text) {
+        module_t& module = modules[i];
+        if (module.content && *module.content == text) {
+            return false;
+        }
+        module.content = std::make_shared<const std::string>(text);
+        module.version++;
+        version++;
+        return true;
     }
-    return result;
+};
+
+struct event_result_t {
+    module_t* clicked = nullptr;
+    uint8_t button = 0;
+    bool damaged = false;
 };
 
 struct bar_t {
+    // what was last drawn for a module, and where
+    struct slot_t {
+        std::shared_ptr<const std::string> text;
+        uint64_t version = 0;
+        std::shared_ptr<const layout_t> layout;
+        double width = 0;
+        aabb_t aabb;
+        bool dirty = false;
+    };
+
     connection_t& connection;
     screen_t& screen;
     window_t window;
     surface_t surface;
     content_t &content;
+    text_cache_t& text;
     std::string font;
     float font_size;
     std::array<float, 3> foreground;
     std::array<float, 3> background;
-    bar_t(connection_t& _connection, screen_t& _screen, content_t& _content, aabb_t aabb):
+    std::vector<slot_t> slots;
+    // content.version as of the last redraw
+    uint64_t version = 0;
+    std::vector<aabb_t> damaged;
+    std::vector<aabb_t> exposed;
+    bool painted = false;
+    // entirely covered, e.g. by a fullscreen window or a lock screen
+    bool obscured = false;
+    bar_t(connection_t& _connection, screen_t& _screen, content_t& _content, text_cache_t& _text, aabb_t aabb, backend_t backend):
         connection(_connection),
         screen(_screen),
         window(connection, screen, aabb),
-        surface(connection, screen, window),
-        content(_content)
+        surface(connection, screen, window, backend),
+        content(_content),
+        text(_text)
     {
         uint32_t events =
             XCB_EVENT_MASK_EXPOSURE |
+            XCB_EVENT_MASK_VISIBILITY_CHANGE |
             XCB_EVENT_MASK_BUTTON_PRESS;
         xcb_change_window_attributes(connection.connection, window.window, XCB_CW_EVENT_MASK, &events);
 
@@ -77,121 +153,170 @@ struct bar_t {
         const unsigned int orientation {_NET_SYSTEM_TRAY_ORIENTATION_HORZ};
         xcb_change_property(c, XCB_PROP_MODE_REPLACE, w, _NET_SYSTEM_TRAY_ORIENTATION, _NET_SYSTEM_TRAY_ORIENTATION, 32, 1, &orientation);
 
-        xcb_ewmh_connection_t ewmh;
-        xcb_intern_atom_cookie_t *ewmh_cookie = xcb_ewmh_init_atoms(c, &ewmh);
-        xcb_ewmh_init_atoms_replies(&ewmh, ewmh_cookie, nullptr);
+        xcb_ewmh_connection_t& ewmh = connection.ewmh;
 
         std::vector<xcb_atom_t> types = {_NET_WM_WINDOW_TYPE_DOCK, _NET_WM_WINDOW_TYPE_NORMAL};
         xcb_ewmh_set_wm_window_type(&ewmh, w, types.size(), types.data());
         std::vector<xcb_atom_t> states = {_NET_WM_STATE_STICKY, _NET_WM_STATE_ABOVE, _NET_WM_STATE_SKIP_TASKBAR};
         xcb_ewmh_set_wm_state(&ewmh, w, states.size(), states.data());
 
-        xcb_ewmh_wm_strut_partial_t strut {0};
-        strut.top = window.aabb.y1;
-        strut.top_start_x = window.aabb.x0;
-        strut.top_end_x = window.aabb.x1;
-        xcb_ewmh_set_wm_strut_partial(&ewmh, w, strut);
+        set_strut();
 
         xcb_ewmh_set_wm_desktop(&ewmh, w, 0xFFFFFFFF);
         xcb_ewmh_set_wm_pid(&ewmh, w, getpid());
 
-        xcb_flush(connection.connection);
         xcb_map_window(connection.connection, window.window);
 
-        xcb_window_t root_window = 0;
-        {
-            xcb_query_tree_reply_t *reply;
-            if ((reply = xcb_query_tree_reply(c, xcb_query_tree(c, screen.screen->root), nullptr))) {
-                xcb_window_t *children = xcb_query_tree_children(reply);
-                for (int i = 0; i < xcb_query_tree_children_length(reply); i++) {
-                    /*
-                    xcb_icccm_get_wm_class_reply_t icr;
-                    xcb_icccm_get_wm_class_reply(c, xcb_icccm_get_wm_class(c, children[i]), &icr, nullptr);
-                    if (std::string(icr.instance_name) == "root") {
-                    */
-                        root_window = children[i];
-                        break;
-                    //}
-                }
-                free(reply);
-            }
+        if (screen.bottom) {
+            uint16_t mask = XCB_CONFIG_WINDOW_SIBLING | XCB_CONFIG_WINDOW_STACK_MODE;
+            std::vector<uint32_t> values = {screen.bottom, XCB_STACK_MODE_ABOVE};
+            xcb_configure_window(c, w, mask, values.data());
+        }
+    }
+
+    // after the modules were replaced every slot is measured again, which for
+    // text that didn't change is only a text cache lookup
+    void reload() {
+        slots.clear();
+        version = 0;
+        painted = false;
+    }
+
+    void resize(aabb_t aabb) {
+        window.move(aabb);
+        surface.resize();
+        set_strut();
+        reload();
+    }
+
+    // marks a window-local region for repainting on the next redraw
+    void damage(aabb_t aabb) {
+        damaged.push_back(aabb);
+    }
+    // a back buffer still holds what was exposed, so it only needs presenting again
+    void expose(aabb_t aabb) {
+        if (surface.backend == backend_t::direct) {
+            damaged.push_back(aabb);
+        } else {
+            exposed.push_back(aabb);
         }
-        uint16_t mask = XCB_CONFIG_WINDOW_SIBLING | XCB_CONFIG_WINDOW_STACK_MODE;
-        std::vector<uint32_t> values = {root_window, XCB_STACK_MODE_ABOVE};
-        xcb_configure_window(c, w, mask, values.data());
     }
 
+    // only re-measures modules whose text changed, only re-lays out the bar
+    // when a width changed, and only repaints the rectangles that changed
     void redraw() {
-        surface.c->set_source_rgb(background[0], background[1], background[2]);
-        surface.c->paint();
-
-        surface.c->select_font_face(font, Cairo::ToyFontFace::Slant::NORMAL, Cairo::ToyFontFace::Weight::NORMAL);
-        surface.c->set_font_size(font_size);
-        surface.c->set_source_rgb(foreground[0], foreground[1], foreground[2]);
-
-        Cairo::FontExtents font_extents;
-        surface.c->get_font_extents(font_extents);
-
-        aabb_t bar = window.aabb;
-        for (auto& section: content.modules) {
-            Cairo::TextExtents text_extents;
-            surface.c->get_text_extents(section.content.c_str(), text_extents);
-            section.aabb = bar.chop(section.gravity, text_extents.x_advance);
-            surface.c->move_to(section.aabb.x0, section.aabb.y0 + font_extents.ascent);
-            surface.c->show_text(section.content.c_str());
+        span_t span("bar redraw", stats.bar_redraw);
+        std::vector<aabb_t> damage = std::move(damaged);
+        std::vector<aabb_t> present = std::move(exposed);
+        damaged.clear();
+        exposed.clear();
+        if (!painted) {
+            damage.push_back(aabb_t{0, 0, window.aabb.width(), window.aabb.height()});
+            painted = true;
+        }
+        bool relayout = slots.size() != content.modules.size();
+        slots.resize(content.modules.size());
+        for (size_t i = 0; i < slots.size() && content.version != version; i++) {
+            slot_t& slot = slots[i];
+            const module_t& module = content.modules[i];
+            if (slot.version == module.version || !module.content) {
+                continue;
+            }
+            slot.version = module.version;
+            slot.text = module.content;
+            slot.layout = text.get(font, font_size, *slot.text, module.formatter != nullptr);
+            slot.dirty = true;
+            if (slot.layout->width != slot.width) {
+                slot.width = slot.layout->width;
+                relayout = true;
+            }
+        }
+        version = content.version;
+        if (relayout) {
+            aabb_t bar {0, 0, window.aabb.width(), window.aabb.height()};
+            for (size_t i = 0; i < slots.size(); i++) {
+                slot_t& slot = slots[i];
+                aabb_t aabb = bar.chop(content.modules[i].gravity, std::ceil(slot.width));
+                if (aabb != slot.aabb) {
+                    damage.push_back(slot.aabb);
+                    slot.aabb = aabb;
+                    slot.dirty = true;
+                }
+            }
+        }
+        for (auto& slot: slots) {
+            if (slot.dirty) {
+                damage.push_back(slot.aabb);
+                slot.dirty = false;
+            }
         }
 
-        surface.s.flush();
-        xcb_flush(connection.connection);
-    }
-    module_t* handle_events() {
-        xcb_generic_event_t *event = xcb_wait_for_event(connection.connection);
-        module_t* m = nullptr;
-        if (!event) {
-            return nullptr;
+        if (damage.empty() && present.empty()) {
+            return;
+        }
+        surface.begin();
+        for (auto& rect: damage) {
+            if (rect.width() == 0 || rect.height() == 0) {
+                continue;
+            }
+            surface.c->save();
+            surface.c->rectangle(rect.x0, rect.y0, rect.width(), rect.height());
+            surface.c->clip();
+            surface.c->set_source_rgb(background[0], background[1], background[2]);
+            surface.c->paint();
+            surface.c->set_source_rgb(foreground[0], foreground[1], foreground[2]);
+            for (auto& slot: slots) {
+                if (slot.layout && slot.aabb.overlaps(rect)) {
+                    slot.layout->show(surface.c->cobj(), slot.aabb.x0, slot.aabb.y0);
+                }
+            }
+            surface.c->restore();
         }
+
+        present.insert(present.end(), damage.begin(), damage.end());
+        surface.present(present);
+    }
+    void set_strut() {
+        xcb_ewmh_wm_strut_partial_t strut {0};
+        strut.top = window.aabb.y1;
+        strut.top_start_x = window.aabb.x0;
+        strut.top_end_x = window.aabb.x1;
+        xcb_ewmh_set_wm_strut_partial(&connection.ewmh, window.window, strut);
+    }
+
+    event_result_t handle_event(xcb_generic_event_t* event) {
+        event_result_t result;
         switch (event->response_type & ~0x80) {
             case XCB_EXPOSE:
+                {
+                    xcb_expose_event_t &expose = *reinterpret_cast<xcb_expose_event_t*>(event);
+                    if (expose.window != window.window) {
+                        break;
+                    }
+                    this->expose(aabb_t{expose.x, expose.y, expose.width, expose.height});
+                    result.damaged = true;
+                }
                 break;
-            case XCB_EVENT_MASK_BUTTON_PRESS:
+            case XCB_VISIBILITY_NOTIFY:
+                {
+                    xcb_visibility_notify_event_t &visibility = *reinterpret_cast<xcb_visibility_notify_event_t*>(event);
+                    if (visibility.window == window.window) {
+                        obscured = visibility.state == XCB_VISIBILITY_FULLY_OBSCURED;
+                    }
+                }
+                break;
+            case XCB_BUTTON_PRESS:
                 {
                     xcb_button_press_event_t &button_press = *reinterpret_cast<xcb_button_press_event_t*>(event);
+                    if (button_press.event != window.window) {
+                        break;
+                    }
                     aabb_t mouse_aabb {button_press.event_x, button_press.event_y, 0, 0};
 
-                    for (auto& section: content.modules) {
-                        if (section.aabb.contains(mouse_aabb)) {
-                            switch (button_press.detail) {
-                                case 1:
-                                    if (!section.left_click.empty()) {
-                                        exec_nocapture(section.left_click);
-                                    }
-                                    break;
-                                case 2:
-                                    if (!section.middle_click.empty()) {
-                                        exec_nocapture(section.middle_click);
-                                    }
-                                    break;
-                                case 3:
-                                    if (!section.right_click.empty()) {
-                                        exec_nocapture(section.right_click);
-                                    }
-                                    break;
-                                case 4:
-                                    if (!section.wheel_up.empty()) {
-                                        exec_nocapture(section.wheel_up);
-                                    }
-                                    break;
-                                case 5:
-                                    if (!section.wheel_down.empty()) {
-                                        exec_nocapture(section.wheel_down);
-                                    }
-                                    break;
-                                default:
-                                    break;
-                            }
-                            if (!section.exec.empty()) {
-                                m = &section;
-                            }
+                    for (size_t i = 0; i < slots.size(); i++) {
+                        if (slots[i].aabb.contains(mouse_aabb)) {
+                            result.clicked = &content.modules[i];
+                            result.button = button_press.detail;
                             break;
                         }
                     }
@@ -200,7 +325,6 @@ struct bar_t {
             default:
                 break;
         }
-        free(event);
-        return m;
+        return result;
     }
 };
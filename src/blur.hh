@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "parallel.hh"
+#include "simd.hh"
+
+// images here are xrgb, one uint32_t per pixel, which is how X hands out
+// depth 24 and 32 and what cairo's RGB24 wants; strides are in pixels
+// every channel, x included, is treated alike
+
+uint32_t channel(uint32_t pixel, int c) {
+    return (pixel >> (8 * c)) & 0xff;
+}
+
+// averages factor × factor blocks of src into rows y0 to y1 of dst,
+// which is width pixels wide
+void downsample_scalar(const uint32_t* src, size_t src_stride, uint32_t* dst, size_t width, size_t y0, size_t y1, int factor) {
+    const uint32_t area = factor * factor;
+    for (size_t y = y0; y < y1; y++) {
+        for (size_t x = 0; x < width; x++) {
+            uint32_t sums[4] = {};
+            for (int dy = 0; dy < factor; dy++) {
+                const uint32_t* row = src + (y * factor + dy) * src_stride + x * factor;
+                for (int dx = 0; dx < factor; dx++) {
+                    for (int c = 0; c < 4; c++) {
+                        sums[c] += channel(row[dx], c);
+                    }
+                }
+            }
+            uint32_t pixel = 0;
+            for (int c = 0; c < 4; c++) {
+                pixel |= (sums[c] / area) << (8 * c);
+            }
+            dst[y * width + x] = pixel;
+        }
+    }
+}
+
+// the sums of the window around the first pixel, the edge pixel standing
+// in for what lies beyond it
+void first_sums(const uint32_t* pixels, size_t step, size_t count, int radius, int32_t sums[4]) {
+    for (int c = 0; c < 4; c++) {
+        sums[c] = (radius + 1) * channel(pixels[0], c);
+    }
+    for (int i = 1; i <= radius; i++) {
+        uint32_t pixel = pixels[std::min<size_t>(i, count - 1) * step];
+        for (int c = 0; c < 4; c++) {
+            sums[c] += channel(pixel, c);
+        }
+    }
+}
+
+uint32_t average(const int32_t sums[4], float scale) {
+    uint32_t pixel = 0;
+    for (int c = 0; c < 4; c++) {
+        pixel |= static_cast<uint32_t>(sums[c] * scale + 0.5f) << (8 * c);
+    }
+    return pixel;
+}
+
+// a box blur along rows y0 to y1, from src to dst, with a running sum per
+// channel, so the cost doesn't grow with the radius
+void blur_rows_scalar(const uint32_t* src, uint32_t* dst, size_t width, size_t stride, size_t y0, size_t y1, int radius) {
+    const float scale = 1.0f / (2 * radius + 1);
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* row = src + y * stride;
+        uint32_t* out = dst + y * stride;
+        int32_t sums[4];
+        first_sums(row, 1, width, radius, sums);
+        for (size_t x = 0; x < width; x++) {
+            out[x] = average(sums, scale);
+            uint32_t add = row[std::min<size_t>(x + radius + 1, width - 1)];
+            uint32_t sub = row[x >= static_cast<size_t>(radius) ? x - radius : 0];
+            for (int c = 0; c < 4; c++) {
+                sums[c] += static_cast<int32_t>(channel(add, c)) - static_cast<int32_t>(channel(sub, c));
+            }
+        }
+    }
+}
+
+// the same down columns x0 to x1, walking the rows in order, with a sum
+// per column, so memory is read the way it is laid out
+void blur_columns_scalar(const uint32_t* src, uint32_t* dst, size_t height, size_t stride, size_t x0, size_t x1, int radius) {
+    const float scale = 1.0f / (2 * radius + 1);
+    std::vector<int32_t> sums((x1 - x0) * 4);
+    for (size_t x = x0; x < x1; x++) {
+        first_sums(src + x, stride, height, radius, &sums[(x - x0) * 4]);
+    }
+    for (size_t y = 0; y < height; y++) {
+        const uint32_t* add = src + std::min<size_t>(y + radius + 1, height - 1) * stride;
+        const uint32_t* sub = src + (y >= static_cast<size_t>(radius) ? y - radius : 0) * stride;
+        uint32_t* out = dst + y * stride;
+        for (size_t x = x0; x < x1; x++) {
+            int32_t* s = &sums[(x - x0) * 4];
+            out[x] = average(s, scale);
+            for (int c = 0; c < 4; c++) {
+                s[c] += static_cast<int32_t>(channel(add[x], c)) - static_cast<int32_t>(channel(sub[x], c));
+            }
+        }
+    }
+}
+
+#if defined(__x86_64__)
+// a pixel's channels as 32-bit lanes, and back
+__m128i widen(uint32_t pixel) {
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
+}
+uint32_t narrow(__m128i sums, __m128 scale) {
+    __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sums), scale));
+    v = _mm_packs_epi32(v, v);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+}
+
+// the average of the 4 × 4 block at block, a row of 4 pixels per add
+uint32_t downsample4_sse2(const uint32_t* block, size_t stride) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = zero;
+    for (int dy = 0; dy < 4; dy++) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + dy * stride));
+        sums = _mm_add_epi16(sums, _mm_add_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)));
+    }
+    sums = _mm_srli_epi16(_mm_add_epi16(sums, _mm_srli_si128(sums, 8)), 4);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(sums, sums));
+}
+void downsample4_sse2(const uint32_t* src, size_t src_stride, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+        for (size_t x = 0; x < width; x++) {
+            dst[y * width + x] = downsample4_sse2(src + y * 4 * src_stride + x * 4, src_stride);
+        }
+    }
+}
+
+// every channel of a pixel at once
+void blur_rows_sse2(const uint32_t* src, uint32_t* dst, size_t width, size_t stride, size_t y0, size_t y1, int radius) {
+    const __m128 scale = _mm_set1_ps(1.0f / (2 * radius + 1));
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* row = src + y * stride;
+        uint32_t* out = dst + y * stride;
+        int32_t first[4];
+        first_sums(row, 1, width, radius, first);
+        __m128i sums = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        for (size_t x = 0; x < width; x++) {
+            out[x] = narrow(sums, scale);
+            uint32_t add = row[std::min<size_t>(x + radius + 1, width - 1)];
+            uint32_t sub = row[x >= static_cast<size_t>(radius) ? x - radius : 0];
+            sums = _mm_add_epi32(sums, _mm_sub_epi32(widen(add), widen(sub)));
+        }
+    }
+}
+
+void blur_columns_sse2(const uint32_t* src, uint32_t* dst, size_t height, size_t stride, size_t x0, size_t x1, int radius) {
+    const __m128 scale = _mm_set1_ps(1.0f / (2 * radius + 1));
+    std::vector<int32_t> sums((x1 - x0) * 4);
+    for (size_t x = x0; x < x1; x++) {
+        first_sums(src + x, stride, height, radius, &sums[(x - x0) * 4]);
+    }
+    for (size_t y = 0; y < height; y++) {
+        const uint32_t* add = src + std::min<size_t>(y + radius + 1, height - 1) * stride;
+        const uint32_t* sub = src + (y >= static_cast<size_t>(radius) ? y - radius : 0) * stride;
+        uint32_t* out = dst + y * stride;
+        for (size_t x = x0; x < x1; x++) {
+            __m128i* s = reinterpret_cast<__m128i*>(&sums[(x - x0) * 4]);
+            __m128i v = _mm_loadu_si128(s);
+            out[x] = narrow(v, scale);
+            _mm_storeu_si128(s, _mm_add_epi32(v, _mm_sub_epi32(widen(add[x]), widen(sub[x]))));
+        }
+    }
+}
+
+// two pixels' channels as 32-bit lanes, a in the low half and b in the high
+__attribute__((target("avx2")))
+__m256i widen2(uint32_t a, uint32_t b) {
+    return _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(static_cast<int64_t>(static_cast<uint64_t>(b) << 32 | a)));
+}
+__attribute__((target("avx2")))
+void narrow2(__m256i sums, __m256 scale, uint32_t& a, uint32_t& b) {
+    __m256i v = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(sums), scale));
+    v = _mm256_packs_epi32(v, v);
+    v = _mm256_packus_epi16(v, v);
+    a = _mm256_extract_epi32(v, 0);
+    b = _mm256_extract_epi32(v, 4);
+}
+
+// two output pixels per iteration
+__attribute__((target("avx2")))
+void downsample4_avx2(const uint32_t* src, size_t src_stride, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t y = y0; y < y1; y++) {
+        size_t x = 0;
+        for (; x + 2 <= width; x += 2) {
+            __m256i sums = zero;
+            for (int dy = 0; dy < 4; dy++) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + (y * 4 + dy) * src_stride + x * 4));
+                sums = _mm256_add_epi16(sums, _mm256_add_epi16(_mm256_unpacklo_epi8(v, zero), _mm256_unpackhi_epi8(v, zero)));
+            }
+            sums = _mm256_srli_epi16(_mm256_add_epi16(sums, _mm256_srli_si256(sums, 8)), 4);
+            sums = _mm256_packus_epi16(sums, sums);
+            dst[y * width + x] = _mm256_extract_epi32(sums, 0);
+            dst[y * width + x + 1] = _mm256_extract_epi32(sums, 4);
+        }
+        if (x < width) {
+            dst[y * width + x] = downsample4_sse2(src + y * 4 * src_stride + x * 4, src_stride);
+        }
+    }
+}
+
+// two rows side by side, one in each half
+__attribute__((target("avx2")))
+void blur_rows_avx2(const uint32_t* src, uint32_t* dst, size_t width, size_t stride, size_t y0, size_t y1, int radius) {
+    const __m256 scale = _mm256_set1_ps(1.0f / (2 * radius + 1));
+    size_t y = y0;
+    for (; y + 2 <= y1; y += 2) {
+        const uint32_t* row0 = src + y * stride;
+        const uint32_t* row1 = row0 + stride;
+        uint32_t* out0 = dst + y * stride;
+        uint32_t* out1 = out0 + stride;
+        int32_t first0[4];
+        int32_t first1[4];
+        first_sums(row0, 1, width, radius, first0);
+        first_sums(row1, 1, width, radius, first1);
+        __m256i sums = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first0))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(first1)), 1);
+        for (size_t x = 0; x < width; x++) {
+            narrow2(sums, scale, out0[x], out1[x]);
+            size_t add = std::min<size_t>(x + radius + 1, width - 1);
+            size_t sub = x >= static_cast<size_t>(radius) ? x - radius : 0;
+            sums = _mm256_add_epi32(sums, _mm256_sub_epi32(widen2(row0[add], row1[add]), widen2(row0[sub], row1[sub])));
+        }
+    }
+    if (y < y1) {
+        blur_rows_sse2(src, dst, width, stride, y, y1, radius);
+    }
+}
+
+// two neighbouring columns per iteration
+__attribute__((target("avx2")))
+void blur_columns_avx2(const uint32_t* src, uint32_t* dst, size_t height, size_t stride, size_t x0, size_t x1, int radius) {
+    const __m256 scale = _mm256_set1_ps(1.0f / (2 * radius + 1));
+    const __m128 scale4 = _mm_set1_ps(1.0f / (2 * radius + 1));
+    std::vector<int32_t> sums((x1 - x0) * 4);
+    for (size_t x = x0; x < x1; x++) {
+        first_sums(src + x, stride, height, radius, &sums[(x - x0) * 4]);
+    }
+    for (size_t y = 0; y < height; y++) {
+        const uint32_t* add = src + std::min<size_t>(y + radius + 1, height - 1) * stride;
+        const uint32_t* sub = src + (y >= static_cast<size_t>(radius) ? y - radius : 0) * stride;
+        uint32_t* out = dst + y * stride;
+        size_t x = x0;
+        for (; x + 2 <= x1; x += 2) {
+            __m256i* s = reinterpret_cast<__m256i*>(&sums[(x - x0) * 4]);
+            __m256i v = _mm256_loadu_si256(s);
+            narrow2(v, scale, out[x], out[x + 1]);
+            _mm256_storeu_si256(s, _mm256_add_epi32(v, _mm256_sub_epi32(widen2(add[x], add[x + 1]), widen2(sub[x], sub[x + 1]))));
+        }
+        if (x < x1) {
+            __m128i* s = reinterpret_cast<__m128i*>(&sums[(x - x0) * 4]);
+            __m128i v = _mm_loadu_si128(s);
+            out[x] = narrow(v, scale4);
+            _mm_storeu_si128(s, _mm_add_epi32(v, _mm_sub_epi32(widen(add[x]), widen(sub[x]))));
+        }
+    }
+}
+#endif
+
+// shrinks src by factor into dst, which is width / factor × height / factor
+// only a factor of 4 is vectorised
+void downsample(const uint32_t* src, size_t width, size_t height, size_t src_stride, int factor, uint32_t* dst,
+    simd_t simd = best_simd(), size_t threads = std::thread::hardware_concurrency()) {
+    size_t dst_width = width / factor;
+    parallel_for(height / factor, [&](size_t y0, size_t y1) {
+#if defined(__x86_64__)
+        if (factor == 4 && simd == simd_t::avx2) {
+            downsample4_avx2(src, src_stride, dst, dst_width, y0, y1);
+            return;
+        }
+        if (factor == 4 && simd == simd_t::sse2) {
+            downsample4_sse2(src, src_stride, dst, dst_width, y0, y1);
+            return;
+        }
+#endif
+        downsample_scalar(src, src_stride, dst, dst_width, y0, y1, factor);
+    }, threads);
+}
+
+// passes box blurs of the given radius in place; three come close to a
+// gaussian of about the same radius
+// rows are split between threads for the horizontal blur, and bands of
+// columns for the vertical one
+void box_blur(uint32_t* pixels, size_t width, size_t height, size_t stride, int radius, int passes,
+    simd_t simd = best_simd(), size_t threads = std::thread::hardware_concurrency()) {
+    if (radius <= 0 || width == 0 || height == 0) {
+        return;
+    }
+    std::vector<uint32_t> temp(stride * height);
+    const auto rows = [&](size_t y0, size_t y1) {
+        switch (simd) {
+#if defined(__x86_64__)
+            case simd_t::avx2:
+                blur_rows_avx2(pixels, temp.data(), width, stride, y0, y1, radius);
+                return;
+            case simd_t::sse2:
+                blur_rows_sse2(pixels, temp.data(), width, stride, y0, y1, radius);
+                return;
+#endif
+            default:
+                blur_rows_scalar(pixels, temp.data(), width, stride, y0, y1, radius);
+                return;
+        }
+    };
+    // bands of 16 columns, so no two threads write the same cache line
+    const size_t band = 16;
+    const auto columns = [&](size_t b0, size_t b1) {
+        size_t x0 = b0 * band;
+        size_t x1 = std::min(b1 * band, width);
+        switch (simd) {
+#if defined(__x86_64__)
+            case simd_t::avx2:
+                blur_columns_avx2(temp.data(), pixels, height, stride, x0, x1, radius);
+                return;
+            case simd_t::sse2:
+                blur_columns_sse2(temp.data(), pixels, height, stride, x0, x1, radius);
+                return;
+#endif
+            default:
+                blur_columns_scalar(temp.data(), pixels, height, stride, x0, x1, radius);
+                return;
+        }
+    };
+    for (int pass = 0; pass < passes; pass++) {
+        parallel_for(height, rows, threads);
+        parallel_for((width + band - 1) / band, columns, threads);
+    }
+}
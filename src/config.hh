@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <toml.hpp>
+
+#include "area.hh"
+#include "format.hh"
+#include "keys.hh"
+#include "module.hh"
+#include "process.hh"
+
+// everything read from config.toml
+// doesn't touch the X server, so it can be loaded while that is being set up
+struct config_t {
+    std::string font;
+    // in points
+    double font_size;
+    std::array<float, 3> foreground;
+    std::array<float, 3> background;
+    size_t workers;
+    std::string bar_backend;
+    std::string notifications_backend;
+    std::string launcher_backend;
+    int notification_width;
+    size_t notification_lines;
+    size_t notification_columns;
+    std::chrono::milliseconds notification_timeout;
+    // how many matches the launcher shows below what is typed
+    size_t launcher_lines;
+    // of the lock screen's blur in pixels, 0 for none
+    int lock_blur_radius;
+    // checks the password that unlocks the screen
+    std::string lock_pam_service;
+    // a png for the root window, scaled to fill each output; empty for none
+    std::string wallpaper;
+    // how many spans the `trace` ipc command can return, 0 turns tracing off
+    size_t trace_events;
+    // how late module timers may fire, so they can share wakeups
+    std::chrono::milliseconds timer_slack;
+    // stop polling modules while the screen saver is on or no bar can be seen
+    bool pause_when_hidden;
+    // tile windows, unless another window manager is already running
+    bool window_manager;
+    // every configured module is followed by a separator module
+    std::vector<module_t> modules;
+    std::vector<binding_t> bindings;
+};
+
+std::chrono::milliseconds seconds(double s) {
+    return std::chrono::milliseconds(static_cast<int64_t>(s * 1000.0));
+}
+
+// either a string, run through the shell only if it needs one, or an argv array
+command_t find_command(const toml::value& config, const std::string& key) {
+    if (!config.contains(key)) {
+        return command_t{};
+    }
+    const auto& value = toml::find(config, key);
+    if (value.is_array()) {
+        return command_t{toml::get<std::vector<std::string>>(value)};
+    }
+    return command_t{toml::get<std::string>(value)};
+}
+
+// compiled once here, so no tick ever parses a format string or its markup
+std::shared_ptr<formatter_t> find_format(const toml::value& config) {
+    if (!config.contains("format")) {
+        return nullptr;
+    }
+    return std::make_shared<formatter_t>(compile_format(toml::find<std::string>(config, "format")));
+}
+
+config_t load_config(const std::string& path) {
+    const auto data = toml::parse(path);
+    config_t config;
+    config.font = toml::find<std::string>(data, "font");
+    config.font_size = toml::find<float>(data, "font_size");
+    config.foreground = toml::find<std::array<float, 3>>(data, "foreground");
+    config.background = toml::find<std::array<float, 3>>(data, "background");
+    config.workers = toml::find_or<int64_t>(data, "workers", 4);
+    config.bar_backend = toml::find_or<std::string>(data, "bar_backend", "shm");
+    config.notifications_backend = toml::find_or<std::string>(data, "notifications_backend", "shm");
+    config.launcher_backend = toml::find_or<std::string>(data, "launcher_backend", "shm");
+    config.notification_width = toml::find_or<int64_t>(data, "notification_width", 300);
+    config.notification_lines = toml::find_or<int64_t>(data, "notification_lines", 4);
+    config.notification_columns = toml::find_or<int64_t>(data, "notification_columns", 40);
+    config.notification_timeout = seconds(toml::find_or<double>(data, "notification_timeout", 5.0));
+    config.launcher_lines = toml::find_or<int64_t>(data, "launcher_lines", 10);
+    config.lock_blur_radius = toml::find_or<int64_t>(data, "lock_blur_radius", 32);
+    config.lock_pam_service = toml::find_or<std::string>(data, "lock_pam_service", "login");
+    config.wallpaper = toml::find_or<std::string>(data, "wallpaper", "");
+    config.trace_events = toml::find_or<int64_t>(data, "trace_events", 0);
+    config.timer_slack = seconds(toml::find_or<double>(data, "timer_slack", 0.0));
+    config.pause_when_hidden = toml::find_or<bool>(data, "pause_when_hidden", true);
+    config.window_manager = toml::find_or<bool>(data, "window_manager", false);
+
+    const toml::array& modules_config = toml::find(data, "modules").as_array();
+    const auto separator = toml::find_or<std::string>(data, "separator", "");
+    for (const auto& module_config: modules_config) {
+        const auto gravity = toml::find_or<std::string>(module_config, "gravity", "left");
+        aabb_t::direction dir;
+        if (gravity == "left") {
+            dir = aabb_t::direction::left;
+        } else if (gravity == "right") {
+            dir = aabb_t::direction::right;
+        } else {
+            throw std::runtime_error("unknown gravity " + gravity);
+        }
+        const auto type = toml::find_or<std::string>(module_config, "type", "");
+        // native providers are woken by change notifications, so only poll them rarely
+        const double interval = type.empty() ? 1.0 : 60.0;
+        config.modules.emplace_back(module_t{
+            find_command(module_config, "exec"),
+            toml::find_or<std::string>(module_config, "text", ""),
+            dir,
+            find_command(module_config, "left_click"),
+            find_command(module_config, "middle_click"),
+            find_command(module_config, "right_click"),
+            find_command(module_config, "wheel_up"),
+            find_command(module_config, "wheel_down"),
+            seconds(toml::find_or<double>(module_config, "interval", interval)),
+            seconds(toml::find_or<double>(module_config, "timeout", 10.0)),
+            toml::find_or<bool>(module_config, "persist", false),
+            type,
+            toml::find_or<std::string>(module_config, "device", ""),
+            toml::find_or<std::string>(module_config, "name", ""),
+            find_format(module_config),
+        });
+        config.modules.emplace_back(module_t{
+            {}, separator, dir
+        });
+    }
+    if (data.contains("bindings")) {
+        for (const auto& binding_config: toml::find(data, "bindings").as_array()) {
+            const auto keys = toml::find<std::string>(binding_config, "keys");
+            const auto action = toml::find_or<std::string>(binding_config, "action", "");
+            if (!action.empty() && action != "launcher" && action != "lock") {
+                throw std::runtime_error("unknown action " + action);
+            }
+            config.bindings.push_back(binding_t{
+                keys,
+                parse_keys(keys),
+                find_command(binding_config, "exec"),
+                action,
+            });
+        }
+    }
+    return config;
+}
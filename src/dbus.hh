@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <poll.h>
+
+#include <sdbus-c++/sdbus-c++.h>
+
+#include "reactor.hh"
+
+// drives an sdbus-c++ connection from the reactor instead of from a thread
+// of its own, so method handlers run on the same thread as everything else
+struct bus_t {
+    reactor_t& reactor;
+    std::unique_ptr<sdbus::IConnection> connection;
+    timerfd_t timeout;
+    int fd = -1;
+    uint32_t events = 0;
+    uint64_t deadline = UINT64_MAX;
+    uint64_t idle;
+
+    bus_t(reactor_t& _reactor, std::unique_ptr<sdbus::IConnection> _connection):
+        reactor(_reactor),
+        connection(std::move(_connection)),
+        timeout(reactor, [this]() {
+            deadline = UINT64_MAX;
+            process();
+        })
+    {
+        update();
+        // replies and signals sent from handlers are only queued, they need
+        // flushing once the reactor is done with the current batch
+        idle = reactor.add_idle([this]() { process(); });
+    }
+    ~bus_t() {
+        reactor.remove_idle(idle);
+        if (fd != -1) {
+            reactor.remove(fd);
+        }
+    }
+    bus_t(const bus_t&) = delete;
+    bus_t& operator=(const bus_t&) = delete;
+
+    void process() {
+        while (connection->processPendingRequest()) {}
+        update();
+    }
+
+private:
+    // what sd-bus waits for changes with every message, e.g. it only wants
+    // POLLOUT while there is something queued to send
+    void update() {
+        sdbus::IConnection::PollData poll = connection->getEventLoopPollData();
+        uint32_t wanted = 0;
+        if (poll.events & POLLIN) {
+            wanted |= EPOLLIN;
+        }
+        if (poll.events & POLLOUT) {
+            wanted |= EPOLLOUT;
+        }
+        if (poll.fd != fd) {
+            if (fd != -1) {
+                reactor.remove(fd);
+            }
+            fd = poll.fd;
+            events = wanted;
+            reactor.add(fd, [this](uint32_t) { process(); }, events);
+        } else if (wanted != events) {
+            events = wanted;
+            reactor.modify(fd, events);
+        }
+        // an absolute CLOCK_MONOTONIC deadline in microseconds, or none at all
+        if (poll.timeout_usec == deadline) {
+            return;
+        }
+        deadline = poll.timeout_usec;
+        if (deadline == UINT64_MAX) {
+            timeout.disarm();
+        } else {
+            timeout.arm(reactor_t::clock::time_point(std::chrono::microseconds(deadline)));
+        }
+    }
+};
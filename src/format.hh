@@ -0,0 +1,452 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <fmt/format.h>
+#include <pango/pangocairo.h>
+
+// a field as a module reports it
+using value_t = std::variant<std::string, int64_t, double, bool>;
+using fields_t = std::vector<std::pair<std::string, value_t>>;
+
+// a format string split once into pango markup and slots, e.g.
+//     format = "<b>vol</b> {volume:>3}%"
+// a slot is a field name with an optional fmt spec, {{ and }} are braces
+struct template_t {
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    struct piece_t {
+        // literal markup, or for a slot the fmt format string, e.g. "{:>3}"
+        std::string text;
+        // the field a slot shows, npos for literal markup
+        size_t field;
+    };
+
+    std::string source;
+    std::vector<piece_t> pieces;
+    std::vector<std::string> fields;
+};
+
+// the markup is checked here, so a broken format fails the config load
+// rather than making pango complain on every tick
+std::shared_ptr<const template_t> compile_format(const std::string& format) {
+    auto compiled = std::make_shared<template_t>();
+    compiled->source = format;
+    std::string literal;
+    std::string markup;
+    const auto flush = [&]() {
+        if (!literal.empty()) {
+            compiled->pieces.push_back({literal, template_t::npos});
+            markup += literal;
+            literal.clear();
+        }
+    };
+    for (size_t i = 0; i < format.size(); i++) {
+        char c = format[i];
+        if ((c == '{' || c == '}') && i + 1 < format.size() && format[i + 1] == c) {
+            literal += c;
+            i++;
+            continue;
+        }
+        if (c == '}') {
+            throw std::runtime_error("unmatched } in format " + format);
+        }
+        if (c != '{') {
+            literal += c;
+            continue;
+        }
+        size_t end = format.find('}', i);
+        if (end == std::string::npos) {
+            throw std::runtime_error("unterminated { in format " + format);
+        }
+        std::string slot = format.substr(i + 1, end - i - 1);
+        size_t colon = slot.find(':');
+        std::string name = slot.substr(0, colon);
+        if (name.empty()) {
+            throw std::runtime_error("unnamed field in format " + format);
+        }
+        flush();
+        size_t field = 0;
+        while (field < compiled->fields.size() && compiled->fields[field] != name) {
+            field++;
+        }
+        if (field == compiled->fields.size()) {
+            compiled->fields.push_back(name);
+        }
+        std::string spec = colon == std::string::npos ? "" : slot.substr(colon);
+        compiled->pieces.push_back({"{" + spec + "}", field});
+        i = end;
+    }
+    flush();
+
+    GError* error = nullptr;
+    if (!pango_parse_markup(markup.c_str(), markup.length(), 0, nullptr, nullptr, nullptr, &error)) {
+        std::string message = error ? error->message : "";
+        if (error) {
+            g_error_free(error);
+        }
+        throw std::runtime_error("bad markup in format " + format + ": " + message);
+    }
+    return compiled;
+}
+
+// a value through a slot's spec, escaped for markup
+// a spec that doesn't suit the value, e.g. {:.1f} on a string, is ignored
+std::string format_value(const std::string& spec, const value_t& value) {
+    std::string text = std::visit([&](const auto& v) {
+        try {
+            return fmt::format(fmt::runtime(spec), v);
+        } catch (const fmt::format_error&) {
+            return fmt::format("{}", v);
+        }
+    }, value);
+    char* escaped = g_markup_escape_text(text.c_str(), text.length());
+    std::string result = escaped;
+    g_free(escaped);
+    return result;
+}
+
+// a module's template filled in: the latest value of every field, and every
+// piece as last formatted, so only slots whose field changed are formatted again
+struct formatter_t {
+    std::shared_ptr<const template_t> format;
+    std::vector<std::optional<value_t>> values;
+    std::vector<std::string> formatted;
+
+    formatter_t(std::shared_ptr<const template_t> _format):
+        format(std::move(_format)),
+        values(format->fields.size()),
+        formatted(format->pieces.size())
+    {
+        for (size_t i = 0; i < formatted.size(); i++) {
+            if (format->pieces[i].field == template_t::npos) {
+                formatted[i] = format->pieces[i].text;
+            }
+        }
+    }
+
+    // returns whether the template shows the field and its value changed
+    bool set(std::string_view name, const value_t& value) {
+        for (size_t field = 0; field < format->fields.size(); field++) {
+            if (format->fields[field] != name) {
+                continue;
+            }
+            if (values[field] == value) {
+                return false;
+            }
+            values[field] = value;
+            for (size_t i = 0; i < formatted.size(); i++) {
+                if (format->pieces[i].field == field) {
+                    formatted[i] = format_value(format->pieces[i].text, value);
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+    bool set(const fields_t& fields) {
+        bool changed = false;
+        for (const auto& [name, value]: fields) {
+            changed = set(name, value) || changed;
+        }
+        return changed;
+    }
+
+    std::string render() const {
+        std::string result;
+        for (const auto& piece: formatted) {
+            result += piece;
+        }
+        return result;
+    }
+};
+
+// numbers and booleans are typed, anything else is a string
+value_t parse_value(const std::string& text) {
+    if (text == "true" || text == "false") {
+        return text == "true";
+    }
+    if (!text.empty()) {
+        char* end;
+        long long integer = std::strtoll(text.c_str(), &end, 10);
+        if (*end == '\0') {
+            return static_cast<int64_t>(integer);
+        }
+        double real = std::strtod(text.c_str(), &end);
+        if (*end == '\0') {
+            return real;
+        }
+    }
+    return text;
+}
+
+// just enough json for a flat object of strings, numbers and booleans
+// nested objects and arrays, and nulls, are skipped
+struct json_reader_t {
+    std::string_view s;
+    size_t i = 0;
+
+    bool object(fields_t& fields) {
+        space();
+        if (!take('{')) {
+            return false;
+        }
+        space();
+        if (take('}')) {
+            return true;
+        }
+        while (true) {
+            std::string key;
+            space();
+            if (!quoted(key)) {
+                return false;
+            }
+            space();
+            if (!take(':')) {
+                return false;
+            }
+            space();
+            std::optional<value_t> v;
+            if (!value(v)) {
+                return false;
+            }
+            if (v) {
+                fields.emplace_back(std::move(key), std::move(*v));
+            }
+            space();
+            if (take('}')) {
+                return true;
+            }
+            if (!take(',')) {
+                return false;
+            }
+        }
+    }
+
+private:
+    void space() {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) {
+            i++;
+        }
+    }
+    bool take(char c) {
+        if (i < s.size() && s[i] == c) {
+            i++;
+            return true;
+        }
+        return false;
+    }
+    bool word(std::string_view w) {
+        if (s.substr(i, w.size()) == w) {
+            i += w.size();
+            return true;
+        }
+        return false;
+    }
+
+    bool value(std::optional<value_t>& v) {
+        if (i >= s.size()) {
+            return false;
+        }
+        char c = s[i];
+        if (c == '"') {
+            std::string text;
+            if (!quoted(text)) {
+                return false;
+            }
+            v = std::move(text);
+            return true;
+        }
+        if (word("true")) {
+            v = true;
+            return true;
+        }
+        if (word("false")) {
+            v = false;
+            return true;
+        }
+        if (word("null")) {
+            return true;
+        }
+        if (c == '{' || c == '[') {
+            return skip();
+        }
+        size_t begin = i;
+        bool real = false;
+        while (i < s.size() && std::string_view("+-0123456789.eE").find(s[i]) != std::string_view::npos) {
+            real = real || s[i] == '.' || s[i] == 'e' || s[i] == 'E';
+            i++;
+        }
+        if (i == begin) {
+            return false;
+        }
+        std::string number(s.substr(begin, i - begin));
+        if (real) {
+            v = std::strtod(number.c_str(), nullptr);
+        } else {
+            v = static_cast<int64_t>(std::strtoll(number.c_str(), nullptr, 10));
+        }
+        return true;
+    }
+
+    // past a nested object or array, strings and all
+    bool skip() {
+        size_t depth = 0;
+        while (i < s.size()) {
+            char c = s[i];
+            if (c == '"') {
+                std::string ignored;
+                if (!quoted(ignored)) {
+                    return false;
+                }
+                continue;
+            }
+            i++;
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (--depth == 0) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool quoted(std::string& out) {
+        if (!take('"')) {
+            return false;
+        }
+        while (i < s.size()) {
+            char c = s[i++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (i >= s.size()) {
+                return false;
+            }
+            c = s[i++];
+            switch (c) {
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                    {
+                        uint32_t code;
+                        if (!hex(code)) {
+                            return false;
+                        }
+                        // a surrogate pair
+                        uint32_t low;
+                        if (code >= 0xd800 && code < 0xdc00 && word("\\u") && hex(low)) {
+                            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        }
+                        utf8(code, out);
+                    }
+                    break;
+                default: out += c; break;
+            }
+        }
+        return false;
+    }
+    bool hex(uint32_t& code) {
+        if (i + 4 > s.size()) {
+            return false;
+        }
+        std::string digits(s.substr(i, 4));
+        char* end;
+        code = std::strtoul(digits.c_str(), &end, 16);
+        i += 4;
+        return *end == '\0';
+    }
+    static void utf8(uint32_t code, std::string& out) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xc0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xe0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+    }
+};
+
+bool is_field_name(std::string_view name) {
+    if (name.empty()) {
+        return false;
+    }
+    for (char c: name) {
+        bool word = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        if (!word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// what a module printed as fields: a json object, or key=value lines
+// anything else is all one field called text, with its lines joined by spaces
+fields_t parse_fields(std::string_view output) {
+    fields_t fields;
+    size_t first = output.find_first_not_of(" \t\n");
+    if (first != std::string_view::npos && output[first] == '{') {
+        json_reader_t reader {output};
+        if (reader.object(fields)) {
+            return fields;
+        }
+        fields.clear();
+    }
+    bool pairs = first != std::string_view::npos;
+    size_t begin = 0;
+    while (pairs && begin < output.size()) {
+        size_t end = output.find('\n', begin);
+        std::string_view line = output.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin);
+        begin = end == std::string_view::npos ? output.size() : end + 1;
+        if (line.empty()) {
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string_view::npos || !is_field_name(line.substr(0, equals))) {
+            pairs = false;
+            break;
+        }
+        fields.emplace_back(std::string(line.substr(0, equals)), parse_value(std::string(line.substr(equals + 1))));
+    }
+    if (pairs) {
+        return fields;
+    }
+    fields.clear();
+    std::string text(output);
+    for (char& c: text) {
+        if (c == '\n') {
+            c = ' ';
+        }
+    }
+    while (!text.empty() && text.back() == ' ') {
+        text.pop_back();
+    }
+    fields.emplace_back("text", std::move(text));
+    return fields;
+}
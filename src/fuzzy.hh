@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "simd.hh"
+
+// one bit per letter, case folded, and a few shared bits for everything else
+// a name can only match a query if its mask has every bit of the query's
+uint32_t char_mask(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') {
+        c += 'a' - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return uint32_t(1) << (c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return uint32_t(1) << 26;
+    }
+    switch (c) {
+        case '-': return uint32_t(1) << 27;
+        case '_': return uint32_t(1) << 28;
+        case '.': return uint32_t(1) << 29;
+        case ' ': return uint32_t(1) << 30;
+        default: return uint32_t(1) << 31;
+    }
+}
+
+uint32_t mask_of(std::string_view s) {
+    uint32_t mask = 0;
+    for (char c: s) {
+        mask |= char_mask(static_cast<unsigned char>(c));
+    }
+    return mask;
+}
+
+// appends the index of every mask with all the bits of want
+void prefilter_scalar(const uint32_t* masks, size_t count, uint32_t want, std::vector<uint32_t>& out) {
+    for (size_t i = 0; i < count; i++) {
+        if ((masks[i] & want) == want) {
+            out.push_back(i);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+// 4 masks per compare
+void prefilter_sse2(const uint32_t* masks, size_t count, uint32_t want, std::vector<uint32_t>& out) {
+    const __m128i w = _mm_set1_epi32(static_cast<int>(want));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i));
+        unsigned bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(m, w), w)));
+        while (bits) {
+            out.push_back(i + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    for (; i < count; i++) {
+        if ((masks[i] & want) == want) {
+            out.push_back(i);
+        }
+    }
+}
+
+// 8 masks per compare
+__attribute__((target("avx2")))
+void prefilter_avx2(const uint32_t* masks, size_t count, uint32_t want, std::vector<uint32_t>& out) {
+    const __m256i w = _mm256_set1_epi32(static_cast<int>(want));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(masks + i));
+        unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(m, w), w)));
+        while (bits) {
+            out.push_back(i + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    for (; i < count; i++) {
+        if ((masks[i] & want) == want) {
+            out.push_back(i);
+        }
+    }
+}
+#endif
+
+void prefilter(const uint32_t* masks, size_t count, uint32_t want, std::vector<uint32_t>& out, simd_t simd = best_simd()) {
+    switch (simd) {
+#if defined(__x86_64__)
+        case simd_t::avx2:
+            prefilter_avx2(masks, count, want, out);
+            return;
+        case simd_t::sse2:
+            prefilter_sse2(masks, count, want, out);
+            return;
+#endif
+        default:
+            prefilter_scalar(masks, count, want, out);
+            return;
+    }
+}
+
+char fold(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// where the first case-insensitive match of query in name ends, matching
+// each character of query as early as it can, or name.size() if there is
+// none; query is not empty
+size_t match_end_scalar(std::string_view name, std::string_view query) {
+    size_t q = 0;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (fold(name[i]) == fold(query[q]) && ++q == query.size()) {
+            return i;
+        }
+    }
+    return name.size();
+}
+
+#if defined(__x86_64__)
+// 16 characters at a time, folded once by setting the 0x20 bit of upper
+// case letters, with every character of query that matches within them
+// found from one compare each; a name's last few characters are copied out
+// to a whole vector, and as most names fit in one, avx2 gains nothing here
+size_t match_end_sse2(std::string_view name, std::string_view query) {
+    const __m128i a = _mm_set1_epi8('A' - 1);
+    const __m128i z = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    size_t q = 0;
+    for (size_t i = 0; i < name.size(); i += 16) {
+        size_t left = name.size() - i;
+        __m128i v;
+        if (left >= 16) {
+            v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(name.data() + i));
+        } else {
+            alignas(16) char tail[16] = {};
+            std::memcpy(tail, name.data() + i, left);
+            v = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+        }
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, a), _mm_cmplt_epi8(v, z));
+        v = _mm_or_si128(v, _mm_and_si128(upper, case_bit));
+        unsigned valid = left >= 16 ? 0xffff : (1u << left) - 1;
+        while (true) {
+            unsigned bits = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(fold(query[q])))) & valid;
+            if (!bits) {
+                break;
+            }
+            unsigned at = __builtin_ctz(bits);
+            if (++q == query.size()) {
+                return i + at;
+            }
+            // only what comes after this match is left for the next
+            valid &= ~((2u << at) - 1);
+        }
+    }
+    return name.size();
+}
+#endif
+
+size_t match_end(std::string_view name, std::string_view query, simd_t simd) {
+    switch (simd) {
+#if defined(__x86_64__)
+        case simd_t::avx2:
+        case simd_t::sse2:
+            return match_end_sse2(name, query);
+#endif
+        default:
+            return match_end_scalar(name, query);
+    }
+}
+
+// how well query matches name as a case-insensitive subsequence, or -1 if
+// it doesn't: matches at the start, after a separator and right after the
+// previous match score higher, and gaps inside the match cost a little
+// the shortest window that ends at the first complete match is scored,
+// which is what fzf's fast path does, rather than searching every alignment
+// finding that first complete match, the scan over the whole name, is
+// vectorised; walking back from it and scoring the window, which is as
+// short as the match allows, are not
+int fuzzy_score(std::string_view name, std::string_view query, simd_t simd = best_simd()) {
+    if (query.empty()) {
+        return 0;
+    }
+    size_t end = match_end(name, query, simd);
+    if (end == name.size()) {
+        return -1;
+    }
+    size_t q = query.size();
+    size_t start = end;
+    for (; ; start--) {
+        if (fold(name[start]) == fold(query[q - 1]) && --q == 0) {
+            break;
+        }
+    }
+
+    int score = 0;
+    size_t last = start;
+    q = 0;
+    for (size_t i = start; i <= end; i++) {
+        if (q == query.size() || fold(name[i]) != fold(query[q])) {
+            score -= 1;
+            continue;
+        }
+        score += 16;
+        if (i == 0) {
+            score += 32;
+        } else {
+            char before = name[i - 1];
+            bool separator = before == '-' || before == '_' || before == '.' || before == ' ' || before == '/';
+            bool camel = before >= 'a' && before <= 'z' && name[i] >= 'A' && name[i] <= 'Z';
+            if (separator || camel) {
+                score += 24;
+            }
+        }
+        if (q > 0 && last + 1 == i) {
+            score += 24;
+        }
+        last = i;
+        q++;
+    }
+    return score;
+}
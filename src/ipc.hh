@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "reactor.hh"
+
+// $XDG_RUNTIME_DIR/ade.sock, or /tmp/ade-$UID.sock without one
+std::string ipc_path() {
+    const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        return std::string(runtime) + "/ade.sock";
+    }
+    return "/tmp/ade-" + std::to_string(getuid()) + ".sock";
+}
+
+// line based commands on a unix socket, each answered with a reply
+// a command is its first word, the rest of the line is handed to it as is
+// the connection is closed once the client has shut down its side and
+// every reply has been sent, e.g.
+//     echo stats | socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/ade.sock
+struct ipc_t {
+    using handler_t = std::function<std::string(std::string_view)>;
+
+    struct client_t {
+        int fd;
+        std::string in;
+        std::string out;
+        bool done = false;
+        uint32_t events = EPOLLIN;
+    };
+
+    // a client that sends more than this without a newline is dropped
+    static constexpr size_t max_line = 65536;
+
+    reactor_t& reactor;
+    std::string path;
+    int fd = -1;
+    std::map<std::string, handler_t, std::less<>> commands;
+    std::unordered_map<int, std::unique_ptr<client_t>> clients;
+
+    ipc_t(reactor_t& _reactor, std::string _path = ipc_path()):
+        reactor(_reactor),
+        path(std::move(_path))
+    {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cout << "ipc socket path too long: " << path << std::endl;
+            return;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        // a socket left behind by an ade that didn't exit cleanly
+        unlink(path.c_str());
+        mode_t mask = umask(0077);
+        int bound = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        umask(mask);
+        if (bound == -1 || listen(fd, 16) == -1) {
+            std::cout << "ipc bind() failed! " << path << std::endl;
+            close(fd);
+            fd = -1;
+            return;
+        }
+        reactor.add(fd, [this](uint32_t) { accept_clients(); });
+    }
+    ~ipc_t() {
+        for (auto& [client_fd, _]: clients) {
+            reactor.remove(client_fd);
+            close(client_fd);
+        }
+        if (fd != -1) {
+            reactor.remove(fd);
+            close(fd);
+            unlink(path.c_str());
+        }
+    }
+    ipc_t(const ipc_t&) = delete;
+    ipc_t& operator=(const ipc_t&) = delete;
+
+    // the first word of a line, and the rest of it
+    static std::pair<std::string_view, std::string_view> split(std::string_view line) {
+        size_t space = line.find(' ');
+        if (space == std::string_view::npos) {
+            return {line, std::string_view()};
+        }
+        return {line.substr(0, space), line.substr(space + 1)};
+    }
+
+private:
+    void accept_clients() {
+        int client_fd;
+        while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+            auto client = std::make_unique<client_t>();
+            client->fd = client_fd;
+            clients[client_fd] = std::move(client);
+            reactor.add(client_fd, [this, client_fd](uint32_t events) {
+                auto it = clients.find(client_fd);
+                if (it != clients.end() && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    receive(*it->second);
+                }
+                // receiving may have dropped the client
+                it = clients.find(client_fd);
+                if (it != clients.end()) {
+                    send(*it->second);
+                }
+            });
+        }
+    }
+
+    void receive(client_t& client) {
+        std::array<char, 4096> chunk;
+        while (true) {
+            ssize_t n = read(client.fd, chunk.data(), chunk.size());
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                client.done = true;
+                break;
+            }
+            client.in.append(chunk.data(), n);
+        }
+        size_t begin = 0;
+        size_t end;
+        while ((end = client.in.find('\n', begin)) != std::string::npos) {
+            dispatch(client, std::string_view(client.in).substr(begin, end - begin));
+            begin = end + 1;
+        }
+        client.in.erase(0, begin);
+        // a last command without a trailing newline
+        if (client.done && !client.in.empty()) {
+            dispatch(client, client.in);
+            client.in.clear();
+        }
+        if (client.in.size() > max_line) {
+            drop(client);
+        }
+    }
+
+    void dispatch(client_t& client, std::string_view line) {
+        auto [name, args] = split(line);
+        auto it = commands.find(name);
+        if (it == commands.end()) {
+            client.out += "unknown command " + std::string(name) + "\n";
+            return;
+        }
+        client.out += it->second(args);
+    }
+
+    void send(client_t& client) {
+        while (!client.out.empty()) {
+            // a client that went away mustn't take ade down with SIGPIPE
+            ssize_t n = ::send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                drop(client);
+                return;
+            }
+            client.out.erase(0, n);
+        }
+        if (client.done && client.out.empty()) {
+            drop(client);
+            return;
+        }
+        // only wait for writability while there is something left to send,
+        // and stop waiting for input after end of file, which would never go away
+        uint32_t events = 0;
+        if (!client.done) {
+            events |= EPOLLIN;
+        }
+        if (!client.out.empty()) {
+            events |= EPOLLOUT;
+        }
+        if (events != client.events) {
+            client.events = events;
+            reactor.modify(client.fd, events);
+        }
+    }
+
+    void drop(client_t& client) {
+        int client_fd = client.fd;
+        reactor.remove(client_fd);
+        close(client_fd);
+        clients.erase(client_fd);
+    }
+};
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <xcb/xcb.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "process.hh"
+#include "render.hh"
+#include "stats.hh"
+
+// one key press of a binding, e.g. super+shift+Return
+struct stroke_t {
+    xkb_keysym_t keysym;
+    uint16_t mods;
+};
+
+// a shortcut, or a chord of several strokes separated by ;, e.g.
+//     keys = "super+Return"
+//     keys = "super+w ; f"
+// a binding either runs a command or one of ade's own actions, e.g.
+//     action = "launcher"
+struct binding_t {
+    std::string keys;
+    std::vector<stroke_t> strokes;
+    command_t command;
+    std::string action;
+};
+
+std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return {};
+    }
+    return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+uint16_t parse_modifier(const std::string& name) {
+    if (name == "shift") {
+        return XCB_MOD_MASK_SHIFT;
+    } else if (name == "lock") {
+        return XCB_MOD_MASK_LOCK;
+    } else if (name == "ctrl" || name == "control") {
+        return XCB_MOD_MASK_CONTROL;
+    } else if (name == "alt" || name == "mod1") {
+        return XCB_MOD_MASK_1;
+    } else if (name == "mod2") {
+        return XCB_MOD_MASK_2;
+    } else if (name == "mod3") {
+        return XCB_MOD_MASK_3;
+    } else if (name == "super" || name == "mod4") {
+        return XCB_MOD_MASK_4;
+    } else if (name == "mod5") {
+        return XCB_MOD_MASK_5;
+    }
+    return 0;
+}
+
+// resolves key names once, at config load, so a bad one fails the load
+std::vector<stroke_t> parse_keys(const std::string& keys) {
+    std::vector<stroke_t> strokes;
+    size_t begin = 0;
+    while (begin <= keys.size()) {
+        size_t end = keys.find(';', begin);
+        std::string stroke = keys.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        begin = end == std::string::npos ? keys.size() + 1 : end + 1;
+        uint16_t mods = 0;
+        size_t plus;
+        while ((plus = stroke.find('+', 1)) != std::string::npos) {
+            std::string name = trim(stroke.substr(0, plus));
+            uint16_t mod = parse_modifier(name);
+            if (!mod) {
+                throw std::runtime_error("unknown modifier " + name + " in " + keys);
+            }
+            mods |= mod;
+            stroke = stroke.substr(plus + 1);
+        }
+        std::string name = trim(stroke);
+        xkb_keysym_t keysym = xkb_keysym_from_name(name.c_str(), XKB_KEYSYM_NO_FLAGS);
+        if (keysym == XKB_KEY_NoSymbol) {
+            keysym = xkb_keysym_from_name(name.c_str(), XKB_KEYSYM_CASE_INSENSITIVE);
+        }
+        if (keysym == XKB_KEY_NoSymbol) {
+            throw std::runtime_error("unknown key " + name + " in " + keys);
+        }
+        strokes.push_back(stroke_t{keysym, mods});
+    }
+    return strokes;
+}
+
+// the server's keycode to keysym table, from the core protocol
+struct keymap_t {
+    xcb_keycode_t min_keycode = 0;
+    size_t per = 0;
+    std::vector<xcb_keysym_t> keysyms;
+
+    bool load(xcb_connection_t* c) {
+        const xcb_setup_t* setup = xcb_get_setup(c);
+        size_t count = setup->max_keycode - setup->min_keycode + 1;
+        xcb_get_keyboard_mapping_reply_t* mapping = xcb_get_keyboard_mapping_reply(c,
+            xcb_get_keyboard_mapping(c, setup->min_keycode, count), nullptr);
+        if (!mapping) {
+            return false;
+        }
+        const xcb_keysym_t* first = xcb_get_keyboard_mapping_keysyms(mapping);
+        min_keycode = setup->min_keycode;
+        per = mapping->keysyms_per_keycode;
+        keysyms.assign(first, first + count * per);
+        free(mapping);
+        return true;
+    }
+
+    size_t size() const {
+        return per ? keysyms.size() / per : 0;
+    }
+    // column 0 is the plain keysym, column 1 the shifted one
+    xcb_keysym_t at(size_t i, size_t column) const {
+        return column < per ? keysyms[i * per + column] : XKB_KEY_NoSymbol;
+    }
+
+    // what a key press types, for text entry
+    xkb_keysym_t keysym(xcb_keycode_t keycode, uint16_t state) const {
+        size_t i = keycode - min_keycode;
+        if (keycode < min_keycode || i >= size()) {
+            return XKB_KEY_NoSymbol;
+        }
+        xkb_keysym_t plain = at(i, 0);
+        xkb_keysym_t shifted = at(i, 1);
+        if (shifted == XKB_KEY_NoSymbol) {
+            shifted = xkb_keysym_to_upper(plain);
+        }
+        bool shift = state & XCB_MOD_MASK_SHIFT;
+        // caps lock only shifts letters
+        if ((state & XCB_MOD_MASK_LOCK) && xkb_keysym_to_upper(plain) != plain) {
+            shift = !shift;
+        }
+        return shift ? shifted : plain;
+    }
+};
+
+// grabs every binding's first stroke on the root and runs its command,
+// without a shell unless it needs one
+// the bindings are compiled into a trie of flat tables keyed by keycode and
+// modifiers, so a key press is one hash lookup however many bindings there
+// are; while a chord is in progress the whole keyboard is grabbed, and any
+// key that doesn't continue it cancels it
+struct keys_t {
+    struct node_t {
+        std::unordered_map<uint32_t, size_t> next;
+        command_t command;
+        std::string action;
+    };
+
+    // caps lock and num lock (mod2) don't change what a key means
+    static constexpr uint16_t modifiers = XCB_MOD_MASK_SHIFT | XCB_MOD_MASK_CONTROL |
+        XCB_MOD_MASK_1 | XCB_MOD_MASK_3 | XCB_MOD_MASK_4 | XCB_MOD_MASK_5;
+
+    connection_t& connection;
+    screen_t& screen;
+    std::vector<binding_t> bindings;
+    // what an action binding calls, by name
+    std::map<std::string, std::function<void()>> actions;
+    keymap_t keymap;
+    // nodes[0] holds the first strokes, which are what is grabbed
+    std::vector<node_t> nodes;
+    size_t at = 0;
+    // keycodes of shift, super and the like, which never cancel a chord
+    std::vector<bool> modifier_keys;
+
+    keys_t(connection_t& _connection, screen_t& _screen, std::vector<binding_t> _bindings):
+        connection(_connection),
+        screen(_screen)
+    {
+        reload(std::move(_bindings));
+    }
+    keys_t(const keys_t&) = delete;
+    keys_t& operator=(const keys_t&) = delete;
+
+    void reload(std::vector<binding_t> next) {
+        bindings = std::move(next);
+        build();
+    }
+
+    // returns true if the event was a key press or keymap change
+    bool handle_event(xcb_generic_event_t* event) {
+        switch (event->response_type & ~0x80) {
+            case XCB_KEY_PRESS:
+                press(*reinterpret_cast<xcb_key_press_event_t*>(event));
+                return true;
+            case XCB_MAPPING_NOTIFY:
+                {
+                    uint8_t request = reinterpret_cast<xcb_mapping_notify_event_t*>(event)->request;
+                    if (request == XCB_MAPPING_KEYBOARD || request == XCB_MAPPING_MODIFIER) {
+                        build();
+                    }
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    static uint32_t key_of(xcb_keycode_t keycode, uint16_t mods) {
+        return static_cast<uint32_t>(keycode) << 16 | mods;
+    }
+
+    void press(const xcb_key_press_event_t& press) {
+        span_t span("key", stats.keys);
+        if (press.detail < modifier_keys.size() && modifier_keys[press.detail]) {
+            return;
+        }
+        auto it = nodes[at].next.find(key_of(press.detail, press.state & modifiers));
+        if (it == nodes[at].next.end()) {
+            cancel();
+            return;
+        }
+        node_t& node = nodes[it->second];
+        if (!node.next.empty()) {
+            if (at == 0) {
+                xcb_grab_keyboard_cookie_t grab = xcb_grab_keyboard(connection.connection, true, screen.screen->root,
+                    XCB_CURRENT_TIME, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+                xcb_discard_reply(connection.connection, grab.sequence);
+            }
+            at = it->second;
+            return;
+        }
+        cancel();
+        if (!node.action.empty()) {
+            auto action = actions.find(node.action);
+            if (action != actions.end()) {
+                action->second();
+            }
+            return;
+        }
+        // reaped by children_t, which ignores pids nobody watches
+        spawn(node.command, nullptr, false);
+    }
+
+    void cancel() {
+        if (at != 0) {
+            xcb_ungrab_keyboard(connection.connection, XCB_CURRENT_TIME);
+            at = 0;
+        }
+    }
+
+    // maps the bindings' keysyms to the current keycodes and grabs again
+    // a keysym only reachable with shift, e.g. exclam, gets shift added
+    void build() {
+        const auto& c = connection.connection;
+        if (!keymap.load(c)) {
+            return;
+        }
+        const auto keycodes_of = [&](stroke_t stroke) {
+            std::vector<std::pair<xcb_keycode_t, uint16_t>> found;
+            for (size_t column = 0; column < std::min<size_t>(keymap.per, 2) && found.empty(); column++) {
+                for (size_t i = 0; i < keymap.size(); i++) {
+                    if (keymap.at(i, column) == stroke.keysym) {
+                        found.emplace_back(keymap.min_keycode + i, stroke.mods | (column ? XCB_MOD_MASK_SHIFT : 0));
+                    }
+                }
+            }
+            return found;
+        };
+
+        modifier_keys.assign(keymap.min_keycode + keymap.size(), false);
+        for (size_t i = 0; i < keymap.size(); i++) {
+            xcb_keysym_t keysym = keymap.at(i, 0);
+            modifier_keys[keymap.min_keycode + i] =
+                (keysym >= XKB_KEY_Shift_L && keysym <= XKB_KEY_Hyper_R) || keysym == XKB_KEY_ISO_Level3_Shift;
+        }
+
+        cancel();
+        nodes.assign(1, node_t{});
+        for (const binding_t& binding: bindings) {
+            std::vector<size_t> ends = {0};
+            bool bound = true;
+            for (const stroke_t& stroke: binding.strokes) {
+                auto keys = keycodes_of(stroke);
+                if (keys.empty()) {
+                    std::cout << "no key for " << binding.keys << std::endl;
+                    bound = false;
+                    break;
+                }
+                std::vector<size_t> next;
+                for (size_t end: ends) {
+                    for (auto [keycode, mods]: keys) {
+                        uint32_t key = key_of(keycode, mods);
+                        auto it = nodes[end].next.find(key);
+                        if (it == nodes[end].next.end()) {
+                            it = nodes[end].next.emplace(key, nodes.size()).first;
+                            nodes.emplace_back();
+                        }
+                        next.push_back(it->second);
+                    }
+                }
+                ends = std::move(next);
+            }
+            if (!bound) {
+                continue;
+            }
+            for (size_t end: ends) {
+                if (!nodes[end].next.empty() || !nodes[end].command.empty() || !nodes[end].action.empty()) {
+                    std::cout << "binding " << binding.keys << " clashes with another one" << std::endl;
+                }
+                nodes[end].command = binding.command;
+                nodes[end].action = binding.action;
+            }
+        }
+
+        xcb_window_t root = screen.screen->root;
+        xcb_ungrab_key(c, XCB_GRAB_ANY, root, XCB_MOD_MASK_ANY);
+        // every binding once more for each state of caps lock and num lock
+        const uint16_t extras[] = {0, XCB_MOD_MASK_LOCK, XCB_MOD_MASK_2, XCB_MOD_MASK_LOCK | XCB_MOD_MASK_2};
+        for (const auto& [key, _]: nodes[0].next) {
+            for (uint16_t extra: extras) {
+                xcb_grab_key(c, true, root, (key & 0xffff) | extra, key >> 16, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+            }
+        }
+    }
+};
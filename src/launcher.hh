@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <pango/pangocairo.h>
+#include <xcb/xcb.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "apps.hh"
+#include "keys.hh"
+#include "process.hh"
+#include "reactor.hh"
+#include "render.hh"
+#include "stats.hh"
+#include "text.hh"
+
+// a run/open menu: a line to type into, and the best matching apps below it
+// the keyboard is grabbed while it is open; return runs the selected app,
+// or what was typed if nothing matches, and escape closes it
+// each key press narrows the last matches rather than searching again, and
+// only the lines shown are shaped, through the shared text cache
+struct launcher_t {
+    connection_t& connection;
+    screen_t& screen;
+    reactor_t& reactor;
+    text_cache_t& text;
+    apps_t& apps;
+    const keymap_t& keymap;
+    window_t window;
+    surface_t surface;
+    search_t search;
+    size_t lines;
+    std::string font;
+    double font_size;
+    double line_height;
+    std::array<float, 3> foreground;
+    std::array<float, 3> background;
+    std::string query;
+    std::vector<match_t> shown;
+    size_t selected = 0;
+    bool opened = false;
+    bool mapped = false;
+    bool exposed = false;
+    uint64_t version = 0;
+    uint64_t drawn_version = 0;
+
+    launcher_t(connection_t& _connection, screen_t& _screen, reactor_t& _reactor, text_cache_t& _text, apps_t& _apps, const keymap_t& _keymap, aabb_t aabb, size_t _lines, backend_t backend):
+        connection(_connection),
+        screen(_screen),
+        reactor(_reactor),
+        text(_text),
+        apps(_apps),
+        keymap(_keymap),
+        window(connection, screen, aabb),
+        surface(connection, screen, window, backend),
+        search(apps.index),
+        lines(_lines)
+    {
+        uint32_t mask = XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK;
+        uint32_t values[] = {1, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS};
+        xcb_change_window_attributes(connection.connection, window.window, mask, values);
+    }
+
+    void open() {
+        if (opened) {
+            return;
+        }
+        opened = true;
+        query.clear();
+        selected = 0;
+        update();
+        xcb_grab_keyboard_cookie_t grab = xcb_grab_keyboard(connection.connection, true, screen.screen->root,
+            XCB_CURRENT_TIME, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+        xcb_discard_reply(connection.connection, grab.sequence);
+    }
+
+    void close() {
+        if (!opened) {
+            return;
+        }
+        opened = false;
+        xcb_ungrab_keyboard(connection.connection, XCB_CURRENT_TIME);
+        changed();
+    }
+
+    // after the index was rebuilt, which leaves the matches pointing nowhere
+    void refresh() {
+        if (opened) {
+            update();
+        }
+    }
+
+    void redraw() {
+        if (version == drawn_version && !exposed) {
+            return;
+        }
+        drawn_version = version;
+        exposed = false;
+        const auto& c = connection.connection;
+        if (!opened) {
+            if (mapped) {
+                xcb_unmap_window(c, window.window);
+                mapped = false;
+            }
+            return;
+        }
+        surface.begin();
+        cairo_t* cr = surface.c->cobj();
+        cairo_set_source_rgb(cr, background[0], background[1], background[2]);
+        cairo_paint(cr);
+        cairo_set_source_rgb(cr, foreground[0], foreground[1], foreground[2]);
+        text.get(font, font_size, "> " + query)->show(cr, 0, 0);
+        for (size_t row = 0; row < shown.size(); row++) {
+            double y = (row + 1) * line_height;
+            if (row == selected) {
+                cairo_rectangle(cr, 0, y, window.aabb.width(), line_height);
+                cairo_fill(cr);
+                cairo_set_source_rgb(cr, background[0], background[1], background[2]);
+            }
+            text.get(font, font_size, std::string(apps.index.name(shown[row].entry)))->show(cr, 0, y);
+            if (row == selected) {
+                cairo_set_source_rgb(cr, foreground[0], foreground[1], foreground[2]);
+            }
+        }
+        surface.present({aabb_t{0, 0, window.aabb.width(), window.aabb.height()}});
+        if (!mapped) {
+            xcb_map_window(c, window.window);
+            mapped = true;
+        }
+    }
+
+    // after the font or colours changed, also moves the window if its
+    // size changed with the font
+    void restyle(aabb_t aabb) {
+        if (aabb != window.aabb) {
+            window.move(aabb);
+            surface.resize();
+        }
+        changed();
+    }
+
+    // returns true if the event was for the launcher, which is every key
+    // press while it is open
+    bool handle_event(xcb_generic_event_t* event) {
+        switch (event->response_type & ~0x80) {
+            case XCB_EXPOSE:
+                if (reinterpret_cast<xcb_expose_event_t*>(event)->window != window.window) {
+                    return false;
+                }
+                exposed = true;
+                reactor.request_frame();
+                return true;
+            case XCB_KEY_PRESS:
+                if (!opened) {
+                    return false;
+                }
+                key(*reinterpret_cast<xcb_key_press_event_t*>(event));
+                return true;
+            case XCB_BUTTON_PRESS:
+                {
+                    xcb_button_press_event_t& button_press = *reinterpret_cast<xcb_button_press_event_t*>(event);
+                    if (button_press.event != window.window) {
+                        return false;
+                    }
+                    size_t row = button_press.event_y / line_height;
+                    if (row > 0 && row <= shown.size()) {
+                        run(row - 1);
+                    }
+                    return true;
+                }
+            default:
+                return false;
+        }
+    }
+
+private:
+    void key(const xcb_key_press_event_t& press) {
+        span_t span("launcher key", stats.launcher);
+        xkb_keysym_t keysym = keymap.keysym(press.detail, press.state);
+        bool control = press.state & XCB_MOD_MASK_CONTROL;
+        switch (keysym) {
+            case XKB_KEY_Escape:
+                close();
+                return;
+            case XKB_KEY_Return:
+            case XKB_KEY_KP_Enter:
+                run(selected);
+                return;
+            case XKB_KEY_Up:
+            case XKB_KEY_ISO_Left_Tab:
+                select(selected == 0 ? 0 : selected - 1);
+                return;
+            case XKB_KEY_Down:
+            case XKB_KEY_Tab:
+                select(selected + 1);
+                return;
+            case XKB_KEY_BackSpace:
+                // a whole utf-8 sequence
+                while (!query.empty() && (query.back() & 0xc0) == 0x80) {
+                    query.pop_back();
+                }
+                if (!query.empty()) {
+                    query.pop_back();
+                }
+                update();
+                return;
+            default:
+                break;
+        }
+        if (control) {
+            if (keysym == XKB_KEY_u) {
+                query.clear();
+                update();
+            } else if (keysym == XKB_KEY_p) {
+                select(selected == 0 ? 0 : selected - 1);
+            } else if (keysym == XKB_KEY_n) {
+                select(selected + 1);
+            }
+            return;
+        }
+        if (press.state & (XCB_MOD_MASK_1 | XCB_MOD_MASK_4)) {
+            return;
+        }
+        char typed[8];
+        int length = xkb_keysym_to_utf8(keysym, typed, sizeof(typed));
+        // the length includes the terminating nul; control characters aren't typed
+        if (length > 1 && static_cast<unsigned char>(typed[0]) >= 0x20 && typed[0] != 0x7f) {
+            query.append(typed, length - 1);
+            update();
+        }
+    }
+
+    void select(size_t row) {
+        size_t next = std::min(row, shown.empty() ? 0 : shown.size() - 1);
+        if (next != selected) {
+            selected = next;
+            changed();
+        }
+    }
+
+    void update() {
+        search.set(query);
+        shown = search.top(lines);
+        selected = 0;
+        changed();
+    }
+
+    // reaped by children_t, which ignores pids nobody watches
+    void run(size_t row) {
+        std::string exec = row < shown.size() ? std::string(apps.index.exec(shown[row].entry)) : query;
+        close();
+        if (!exec.empty()) {
+            spawn(command_t{exec}, nullptr, false);
+        }
+    }
+
+    void changed() {
+        version++;
+        reactor.request_frame();
+    }
+};
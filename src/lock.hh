@@ -0,0 +1,519 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <pwd.h>
+#include <sys/eventfd.h>
+#include <sys/shm.h>
+#include <unistd.h>
+
+#include <cairo/cairo.h>
+#include <security/pam_appl.h>
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "blur.hh"
+#include "keys.hh"
+#include "reactor.hh"
+#include "render.hh"
+#include "stats.hh"
+#include "text.hh"
+
+// overwrites a secret before its memory is given back
+void wipe(std::string& secret) {
+    explicit_bzero(secret.data(), secret.size());
+    secret.clear();
+}
+
+// answers every prompt pam makes with the password
+int pam_converse(int count, const pam_message** messages, pam_response** responses, void* data) {
+    const std::string& password = *static_cast<const std::string*>(data);
+    *responses = static_cast<pam_response*>(calloc(count, sizeof(pam_response)));
+    if (!*responses) {
+        return PAM_BUF_ERR;
+    }
+    for (int i = 0; i < count; i++) {
+        int style = messages[i]->msg_style;
+        if (style == PAM_PROMPT_ECHO_OFF || style == PAM_PROMPT_ECHO_ON) {
+            (*responses)[i].resp = strdup(password.c_str());
+        }
+    }
+    return PAM_SUCCESS;
+}
+
+// checks the password of the user ade runs as with the given pam service
+// blocks for as long as pam takes, which after a wrong password is seconds
+bool authenticate(const std::string& service, const std::string& password) {
+    passwd entry;
+    passwd* found = nullptr;
+    std::array<char, 4096> buffer;
+    if (getpwuid_r(getuid(), &entry, buffer.data(), buffer.size(), &found) != 0 || !found) {
+        return false;
+    }
+    pam_conv conversation {pam_converse, const_cast<std::string*>(&password)};
+    pam_handle_t* handle = nullptr;
+    if (pam_start(service.c_str(), found->pw_name, &conversation, &handle) != PAM_SUCCESS) {
+        std::cout << "pam_start() failed!" << std::endl;
+        return false;
+    }
+    int result = pam_authenticate(handle, 0);
+    if (result == PAM_SUCCESS) {
+        pam_setcred(handle, PAM_REFRESH_CRED);
+    }
+    pam_end(handle, result);
+    return result == PAM_SUCCESS;
+}
+
+// covers the whole screen with a blurred picture of what was on it, and
+// holds the keyboard and pointer until the user's password is typed
+// the root is read with MIT-SHM straight into memory shared with the
+// server, shrunk by `scale` and blurred there across every core, and the
+// small picture is uploaded once and stretched back by the server, so a
+// lock costs about one copy of the screen and typing only redraws the box
+// that shows how much was typed; pam runs on a thread of its own
+struct lock_t {
+    using clock = std::chrono::steady_clock;
+
+    enum class state_t {
+        grabbing, typing, checking, wrong,
+    };
+    static constexpr int scale = 4;
+    // grabs are tried every 100ms for this long before the lock gives up,
+    // as a lock that doesn't hold the keyboard would only pretend to lock
+    static constexpr int grab_tries = 20;
+
+    connection_t& connection;
+    screen_t& screen;
+    reactor_t& reactor;
+    text_cache_t& text;
+    const keymap_t& keymap;
+    window_t window;
+    surface_t surface;
+    // of the blur, in screen pixels; 0 shows the screen as it was
+    int radius = 32;
+    std::string pam_service = "login";
+    std::string font;
+    double font_size;
+    double line_height;
+    std::array<float, 3> foreground;
+    std::array<float, 3> background;
+    bool locked = false;
+    bool grabbed = false;
+    int tries = 0;
+    state_t state = state_t::typing;
+    std::string password;
+    // the captured root, kept between locks, as a fresh segment would
+    // be faulted in page by page while the server fills it
+    xcb_shm_seg_t segment = 0;
+    void* shared = nullptr;
+    size_t shared_size = 0;
+    std::vector<uint32_t> small;
+    size_t small_width = 0;
+    size_t small_height = 0;
+    // small, uploaded to the server
+    cairo_surface_t* picture = nullptr;
+    // grabs fail while another client holds them, e.g. an open menu
+    timerfd_t retry;
+    int done;
+    std::thread auth;
+    std::atomic<bool> accepted {false};
+    uint64_t version = 0;
+    uint64_t drawn_version = 0;
+    bool exposed = false;
+
+    lock_t(connection_t& _connection, screen_t& _screen, reactor_t& _reactor, text_cache_t& _text, const keymap_t& _keymap):
+        connection(_connection),
+        screen(_screen),
+        reactor(_reactor),
+        text(_text),
+        keymap(_keymap),
+        window(connection, screen, screen.aabb),
+        surface(connection, screen, window, backend_t::direct),
+        retry(reactor, [this]() { grab(); })
+    {
+        // black until the picture is drawn, so the screen is covered the
+        // moment the window is mapped
+        uint32_t mask = XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK;
+        // visibility changes say when something was mapped above the lock
+        uint32_t values[] = {screen.screen->black_pixel, 1, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_VISIBILITY_CHANGE};
+        xcb_change_window_attributes(connection.connection, window.window, mask, values);
+        done = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        reactor.add(done, [this](uint32_t) { checked(); });
+    }
+    ~lock_t() {
+        if (auth.joinable()) {
+            auth.join();
+        }
+        reactor.remove(done);
+        close(done);
+        if (picture) {
+            cairo_surface_destroy(picture);
+        }
+        detach();
+    }
+    lock_t(const lock_t&) = delete;
+    lock_t& operator=(const lock_t&) = delete;
+
+    void lock() {
+        if (locked) {
+            return;
+        }
+        span_t span("lock", stats.lock);
+        const auto& c = connection.connection;
+        locked = true;
+        tries = 0;
+        state = state_t::grabbing;
+        wipe(password);
+        capture();
+        raise();
+        xcb_map_window(c, window.window);
+        // waiting for the grab replies also flushes everything above
+        grab();
+        if (locked) {
+            draw(true);
+        }
+    }
+
+    void unlock() {
+        if (!locked) {
+            return;
+        }
+        const auto& c = connection.connection;
+        locked = false;
+        grabbed = false;
+        retry.disarm();
+        xcb_ungrab_keyboard(c, XCB_CURRENT_TIME);
+        xcb_ungrab_pointer(c, XCB_CURRENT_TIME);
+        xcb_unmap_window(c, window.window);
+        xcb_flush(c);
+        wipe(password);
+        if (picture) {
+            cairo_surface_destroy(picture);
+            picture = nullptr;
+        }
+        // whatever was held back while locked
+        reactor.request_frame();
+    }
+
+    // after the screen changed size; the picture is stretched to fit
+    void resize(aabb_t aabb) {
+        window.move(aabb);
+        surface.resize();
+        exposed = true;
+        reactor.request_frame();
+    }
+
+    void redraw() {
+        if (!locked || (version == drawn_version && !exposed)) {
+            return;
+        }
+        draw(exposed);
+    }
+
+    // returns true if the event was for the lock, which while locked is
+    // every key and button press
+    bool handle_event(xcb_generic_event_t* event) {
+        switch (event->response_type & ~0x80) {
+            case XCB_EXPOSE:
+                if (reinterpret_cast<xcb_expose_event_t*>(event)->window != window.window) {
+                    return false;
+                }
+                exposed = true;
+                reactor.request_frame();
+                return true;
+            case XCB_KEY_PRESS:
+                if (!locked) {
+                    return false;
+                }
+                key(*reinterpret_cast<xcb_key_press_event_t*>(event));
+                return true;
+            case XCB_BUTTON_PRESS:
+                return locked;
+            case XCB_VISIBILITY_NOTIFY:
+                {
+                    xcb_visibility_notify_event_t& notify = *reinterpret_cast<xcb_visibility_notify_event_t*>(event);
+                    if (notify.window != window.window) {
+                        return false;
+                    }
+                    if (locked && notify.state != XCB_VISIBILITY_UNOBSCURED) {
+                        raise();
+                    }
+                    return true;
+                }
+            default:
+                return false;
+        }
+    }
+
+private:
+    void key(const xcb_key_press_event_t& press) {
+        // typing while pam is busy is dropped
+        if (state == state_t::checking || state == state_t::grabbing) {
+            return;
+        }
+        xkb_keysym_t keysym = keymap.keysym(press.detail, press.state);
+        switch (keysym) {
+            case XKB_KEY_Return:
+            case XKB_KEY_KP_Enter:
+                if (!password.empty()) {
+                    check();
+                }
+                return;
+            case XKB_KEY_Escape:
+                wipe(password);
+                changed(state_t::typing);
+                return;
+            case XKB_KEY_BackSpace:
+                while (!password.empty() && (password.back() & 0xc0) == 0x80) {
+                    password.pop_back();
+                }
+                if (!password.empty()) {
+                    password.pop_back();
+                }
+                changed(state_t::typing);
+                return;
+            default:
+                break;
+        }
+        if (press.state & (XCB_MOD_MASK_CONTROL | XCB_MOD_MASK_1 | XCB_MOD_MASK_4)) {
+            return;
+        }
+        char typed[8];
+        int length = xkb_keysym_to_utf8(keysym, typed, sizeof(typed));
+        if (length > 1 && static_cast<unsigned char>(typed[0]) >= 0x20 && typed[0] != 0x7f) {
+            password.append(typed, length - 1);
+            changed(state_t::typing);
+        }
+        explicit_bzero(typed, sizeof(typed));
+    }
+
+    void check() {
+        changed(state_t::checking);
+        if (auth.joinable()) {
+            auth.join();
+        }
+        std::string attempt = password;
+        wipe(password);
+        auth = std::thread([this, service = pam_service, attempt = std::move(attempt)]() mutable {
+            accepted = authenticate(service, attempt);
+            wipe(attempt);
+            uint64_t one = 1;
+            (void) !write(done, &one, sizeof(one));
+        });
+    }
+
+    void checked() {
+        uint64_t count;
+        while (read(done, &count, sizeof(count)) > 0) {}
+        auth.join();
+        if (accepted) {
+            unlock();
+        } else {
+            changed(state_t::wrong);
+        }
+    }
+
+    void changed(state_t next) {
+        state = next;
+        version++;
+        reactor.request_frame();
+    }
+
+    // above every other child of the root, including override-redirect
+    // windows other clients mapped since
+    void raise() {
+        uint32_t above = XCB_STACK_MODE_ABOVE;
+        xcb_configure_window(connection.connection, window.window, XCB_CONFIG_WINDOW_STACK_MODE, &above);
+    }
+
+    // keeps trying while another client holds a grab, e.g. an open menu,
+    // and unlocks again once grab_tries ran out
+    void grab() {
+        if (!locked || grabbed) {
+            return;
+        }
+        const auto& c = connection.connection;
+        xcb_grab_keyboard_cookie_t keyboard = xcb_grab_keyboard(c, false, window.window,
+            XCB_CURRENT_TIME, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+        xcb_grab_pointer_cookie_t pointer = xcb_grab_pointer(c, false, window.window, XCB_EVENT_MASK_BUTTON_PRESS,
+            XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, XCB_NONE, XCB_CURRENT_TIME);
+        xcb_grab_keyboard_reply_t* keyboard_reply = xcb_grab_keyboard_reply(c, keyboard, nullptr);
+        xcb_grab_pointer_reply_t* pointer_reply = xcb_grab_pointer_reply(c, pointer, nullptr);
+        grabbed = keyboard_reply && keyboard_reply->status == XCB_GRAB_STATUS_SUCCESS &&
+            pointer_reply && pointer_reply->status == XCB_GRAB_STATUS_SUCCESS;
+        free(keyboard_reply);
+        free(pointer_reply);
+        if (grabbed) {
+            changed(state_t::typing);
+            return;
+        }
+        if (++tries >= grab_tries) {
+            std::cout << "lock failed! another client holds the keyboard or pointer" << std::endl;
+            unlock();
+            return;
+        }
+        retry.arm(clock::now() + std::chrono::milliseconds(100));
+    }
+
+    // a segment big enough for the screen, attached on first use
+    bool attach(size_t size) {
+        if (size <= shared_size) {
+            return true;
+        }
+        detach();
+        const auto& c = connection.connection;
+        const xcb_query_extension_reply_t* extension = xcb_get_extension_data(c, &xcb_shm_id);
+        if (!extension || !extension->present) {
+            return false;
+        }
+        int shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        if (shmid == -1) {
+            return false;
+        }
+        shared = shmat(shmid, nullptr, 0);
+        if (shared == reinterpret_cast<void*>(-1)) {
+            shared = nullptr;
+            shmctl(shmid, IPC_RMID, nullptr);
+            return false;
+        }
+        segment = xcb_generate_id(c);
+        xcb_generic_error_t* error = xcb_request_check(c, xcb_shm_attach_checked(c, segment, shmid, false));
+        shmctl(shmid, IPC_RMID, nullptr);
+        if (error) {
+            free(error);
+            shmdt(shared);
+            shared = nullptr;
+            segment = 0;
+            return false;
+        }
+        shared_size = size;
+        return true;
+    }
+
+    void detach() {
+        if (segment) {
+            xcb_shm_detach(connection.connection, segment);
+            shmdt(shared);
+        }
+        segment = 0;
+        shared = nullptr;
+        shared_size = 0;
+    }
+
+    // without MIT-SHM, or on a screen that isn't 24 or 32 bits deep, the
+    // lock is plain black rather than read back the slow way
+    void capture() {
+        const auto& c = connection.connection;
+        if (picture) {
+            cairo_surface_destroy(picture);
+            picture = nullptr;
+        }
+        size_t width = window.aabb.width();
+        size_t height = window.aabb.height();
+        if (width < scale || height < scale || !attach(width * height * sizeof(uint32_t))) {
+            return;
+        }
+        xcb_shm_get_image_reply_t* reply = xcb_shm_get_image_reply(c, xcb_shm_get_image(c, screen.screen->root,
+            0, 0, width, height, ~0u, XCB_IMAGE_FORMAT_Z_PIXMAP, segment, 0), nullptr);
+        bool captured = reply && (reply->depth == 24 || reply->depth == 32);
+        free(reply);
+        if (!captured) {
+            return;
+        }
+        small_width = width / scale;
+        small_height = height / scale;
+        small.resize(small_width * small_height);
+        downsample(static_cast<const uint32_t*>(shared), width, height, width, scale, small.data());
+        if (radius > 0) {
+            box_blur(small.data(), small_width, small_height, small_width, std::max(1, radius / scale), 3);
+        }
+        cairo_surface_t* image = cairo_image_surface_create_for_data(reinterpret_cast<unsigned char*>(small.data()),
+            CAIRO_FORMAT_RGB24, small_width, small_height, small_width * sizeof(uint32_t));
+        picture = cairo_surface_create_similar(surface.s->cobj(), CAIRO_CONTENT_COLOR, small_width, small_height);
+        cairo_t* cr = cairo_create(picture);
+        cairo_set_source_surface(cr, image, 0, 0);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        cairo_surface_destroy(image);
+    }
+
+    // the box on each output that shows the state, centred on it
+    aabb_t box(const output_t& output) {
+        int width = static_cast<int>(12 * line_height);
+        int height = static_cast<int>(2 * line_height);
+        aabb_t area = output.aabb;
+        return aabb_t{area.x0 + (area.width() - width) / 2 - window.aabb.x0, area.y0 + (area.height() - height) / 2 - window.aabb.y0, width, height};
+    }
+
+    // everything, or only the boxes
+    void draw(bool everything) {
+        drawn_version = version;
+        exposed = false;
+        surface.begin();
+        cairo_t* cr = surface.c->cobj();
+        std::vector<aabb_t> damage;
+        if (everything) {
+            damage.push_back(aabb_t{0, 0, window.aabb.width(), window.aabb.height()});
+        } else {
+            for (const output_t& output: screen.outputs) {
+                damage.push_back(box(output));
+            }
+        }
+        cairo_save(cr);
+        for (aabb_t rect: damage) {
+            cairo_rectangle(cr, rect.x0, rect.y0, rect.width(), rect.height());
+        }
+        cairo_clip(cr);
+        if (picture) {
+            cairo_save(cr);
+            cairo_scale(cr, static_cast<double>(window.aabb.width()) / small_width, static_cast<double>(window.aabb.height()) / small_height);
+            cairo_set_source_surface(cr, picture, 0, 0);
+            cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+            cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+            cairo_paint(cr);
+            cairo_restore(cr);
+        } else {
+            cairo_set_source_rgb(cr, 0, 0, 0);
+            cairo_paint(cr);
+        }
+        cairo_restore(cr);
+
+        std::string message;
+        if (state == state_t::grabbing) {
+            message = "waiting for the keyboard";
+        } else if (state == state_t::checking) {
+            message = "checking…";
+        } else if (state == state_t::wrong) {
+            message = "wrong password";
+        } else if (password.empty()) {
+            message = "locked";
+        } else {
+            for (size_t i = 0; i < password.size(); i++) {
+                if ((password[i] & 0xc0) != 0x80) {
+                    message += "•";
+                }
+            }
+        }
+        auto layout = text.get(font, font_size, message);
+        for (const output_t& output: screen.outputs) {
+            aabb_t rect = box(output);
+            cairo_set_source_rgb(cr, background[0], background[1], background[2]);
+            cairo_rectangle(cr, rect.x0, rect.y0, rect.width(), rect.height());
+            cairo_fill(cr);
+            cairo_set_source_rgb(cr, foreground[0], foreground[1], foreground[2]);
+            layout->show(cr, rect.x0 + (rect.width() - std::min<double>(layout->width, rect.width())) / 2, rect.y0 + (rect.height() - layout->height) / 2);
+        }
+        surface.present(damage);
+    }
+};
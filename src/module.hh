@@ -1,11 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "area.hh"
+#include "format.hh"
+#include "process.hh"
+
 struct module_t {
-    std::string exec;
-    std::string content;
-    aabb_t aabb;
+    command_t exec;
+    // shown until the module first publishes something else
+    std::string text;
     aabb_t::direction gravity;
-    std::string left_click;
-    std::string middle_click;
-    std::string right_click;
-    std::string wheel_up;
-    std::string wheel_down;
+    command_t left_click;
+    command_t middle_click;
+    command_t right_click;
+    command_t wheel_up;
+    command_t wheel_down;
+    std::chrono::milliseconds interval {1000};
+    std::chrono::milliseconds timeout {10000};
+    bool persist = false;
+    std::string type;
+    std::string device;
+    // what ipc commands call the module by
+    std::string name;
+    // with a format, output is read as fields and shown through the
+    // template as markup
+    std::shared_ptr<formatter_t> formatter;
+    // the latest published output, never modified once published
+    std::shared_ptr<const std::string> content;
+    uint64_t version = 0;
 };
+
+// whether b would show a's output the same way
+bool same_format(const module_t& a, const module_t& b) {
+    if (!a.formatter || !b.formatter) {
+        return !a.formatter && !b.formatter;
+    }
+    return a.formatter->format->source == b.formatter->format->source;
+}
+
+// whether b can take over from a, keeping its output and whatever is
+// running for it, e.g. across a config reload
+bool same_source(const module_t& a, const module_t& b) {
+    if (a.exec != b.exec || a.persist != b.persist || a.type != b.type || a.device != b.device) {
+        return false;
+    }
+    if (!a.exec.empty() || !a.type.empty()) {
+        return true;
+    }
+    // static modules show nothing but their text, or what was pushed to them
+    return a.name.empty() ? b.name.empty() && a.text == b.text : a.name == b.name;
+}
@@ -1,60 +1,469 @@
-#include <pangomm-2.48/pangomm.h>
-#include <pangomm/context.h>
-#include <pango/pangocairo.h>
-#include <fmt/core.h>
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
-#include <cassert>
+#include <pango/pangocairo.h>
+#include <sdbus-c++/sdbus-c++.h>
 
-#include "pango/pango-layout.h"
+#include "dbus.hh"
+#include "reactor.hh"
 #include "render.hh"
+#include "stats.hh"
+#include "text.hh"
+
+struct notification_t {
+    using clock = std::chrono::steady_clock;
+
+    uint32_t id = 0;
+    std::string app;
+    std::string summary;
+    std::string body;
+    // how many notifications from a burst were folded into this one
+    size_t count = 0;
+    // bumped whenever what is shown for it changes
+    uint64_t version = 0;
+    clock::time_point updated;
+    // time_point::max() for notifications that never expire
+    clock::time_point expires;
+};
+
+// cuts s down to at most columns code points, marking the cut with an ellipsis
+void truncate_utf8(std::string& s, size_t columns) {
+    size_t n = 0;
+    size_t last = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        if ((s[i] & 0xc0) == 0x80) {
+            continue;
+        }
+        if (n == columns) {
+            s.resize(columns == 0 ? 0 : last);
+            if (columns > 0) {
+                s += "…";
+            }
+            return;
+        }
+        last = i;
+        n++;
+    }
+}
+
+// a fixed number of notifications, oldest first
+// slots are reused in place, so once each has held a notification their
+// strings are only reallocated for text longer than anything seen before
+struct notification_ring_t {
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    std::vector<notification_t> slots;
+    size_t head = 0;
+    size_t count = 0;
 
+    notification_ring_t(size_t capacity): slots(std::max<size_t>(1, capacity)) {}
+
+    size_t size() const {
+        return count;
+    }
+    bool full() const {
+        return count == slots.size();
+    }
+    notification_t& operator[](size_t i) {
+        return slots[(head + i) % slots.size()];
+    }
+    // the ring must not be full
+    notification_t& push_back() {
+        return (*this)[count++];
+    }
+    void erase(size_t i) {
+        if (i == 0) {
+            head = (head + 1) % slots.size();
+            count--;
+            return;
+        }
+        for (; i + 1 < count; i++) {
+            std::swap((*this)[i], (*this)[i + 1]);
+        }
+        count--;
+    }
+    // newest first, so bursts find their most recent notification
+    template <typename F>
+    size_t find(F&& f) {
+        for (size_t i = count; i-- > 0;) {
+            if (f((*this)[i])) {
+                return i;
+            }
+        }
+        return npos;
+    }
+};
+
+// one layout per slot of the ring, created up front and reused for whatever
+// notification is shown in it, so memory stays flat however many come and go
+// a layout keeps its parsed markup, and is only set again when its
+// notification changes or the window width does
+struct layout_pool_t {
+    struct entry_t {
+        PangoLayout* layout;
+        uint32_t id = 0;
+        uint64_t version = 0;
+        int width = 0;
+        bool used = false;
+        bool wanted = false;
+    };
+
+    std::vector<entry_t> entries;
+
+    layout_pool_t(PangoContext* context, size_t size) {
+        entries.resize(size);
+        for (auto& entry: entries) {
+            entry.layout = pango_layout_new(context);
+            pango_layout_set_ellipsize(entry.layout, PANGO_ELLIPSIZE_END);
+        }
+    }
+    ~layout_pool_t() {
+        for (auto& entry: entries) {
+            g_object_unref(entry.layout);
+        }
+    }
+    layout_pool_t(const layout_pool_t&) = delete;
+    layout_pool_t& operator=(const layout_pool_t&) = delete;
+
+    // forgets what every layout was set up for, e.g. after the font changed
+    void clear() {
+        for (auto& entry: entries) {
+            entry.id = 0;
+        }
+    }
+
+    // call before a frame's get()s with what the frame is going to show, so
+    // layouts of notifications that are still around aren't handed out
+    void begin(notification_ring_t& ring) {
+        for (auto& entry: entries) {
+            entry.used = false;
+            entry.wanted = entry.id != 0 && ring.find([&](const notification_t& n) { return n.id == entry.id; }) != notification_ring_t::npos;
+        }
+    }
+
+    // the pool must have an entry for every notification of the frame
+    PangoLayout* get(const notification_t& n, PangoFontDescription* desc, int width) {
+        entry_t* entry = nullptr;
+        for (auto& e: entries) {
+            if (e.id == n.id) {
+                entry = &e;
+                break;
+            }
+        }
+        for (auto& e: entries) {
+            if (!entry && !e.used && !e.wanted) {
+                entry = &e;
+            }
+        }
+        entry->used = true;
+        if (entry->id == n.id && entry->version == n.version && entry->width == width) {
+            return entry->layout;
+        }
+        if (entry->id != n.id || entry->version != n.version) {
+            std::string markup = markup_of(n);
+            pango_layout_set_markup(entry->layout, markup.c_str(), markup.length());
+        }
+        pango_layout_set_font_description(entry->layout, desc);
+        pango_layout_set_width(entry->layout, width * PANGO_SCALE);
+        entry->id = n.id;
+        entry->version = n.version;
+        entry->width = width;
+        return entry->layout;
+    }
+
+private:
+    static std::string markup_of(const notification_t& n) {
+        char* summary = g_markup_escape_text(n.summary.c_str(), n.summary.length());
+        char* body = g_markup_escape_text(n.body.c_str(), n.body.length());
+        std::string markup = std::string("<b>") + summary + "</b> " + body;
+        if (n.count > 1) {
+            markup += " (" + std::to_string(n.count) + ")";
+        }
+        g_free(summary);
+        g_free(body);
+        return markup;
+    }
+};
+
+// keeps at most notification_lines notifications, one per line, newest on top
+// a burst of notifications from one app within `burst` of each other is
+// folded into a single line, so a storm of Notify calls costs one slot, one
+// expiry deadline and at most one redraw per frame
 struct notifications_t {
+    using clock = notification_t::clock;
+
+    // reasons for NotificationClosed, from the notification spec
+    enum reason_t : uint32_t {
+        expired = 1,
+        dismissed = 2,
+        closed = 3,
+        undefined = 4,
+    };
+
     connection_t& connection;
     screen_t& screen;
+    reactor_t& reactor;
+    text_cache_t& text;
     window_t window;
     surface_t surface;
-    notifications_t(connection_t& connection, screen_t& screen, aabb_t aabb, size_t notification_lines, size_t notification_columns):
-        connection(connection),
-        screen(screen),
+    notification_ring_t ring;
+    layout_pool_t layouts;
+    size_t columns;
+    std::chrono::milliseconds timeout {5000};
+    std::chrono::milliseconds burst {1000};
+    std::string font;
+    double font_size;
+    double line_height;
+    std::array<float, 3> foreground;
+    std::array<float, 3> background;
+    std::function<void(uint32_t, uint32_t)> on_closed;
+    timerfd_t expiry;
+    clock::time_point next_expiry = clock::time_point::max();
+    uint32_t next_id = 1;
+    uint64_t version = 0;
+    uint64_t drawn_version = 0;
+    bool exposed = false;
+    bool mapped = false;
+
+    notifications_t(connection_t& _connection, screen_t& _screen, reactor_t& _reactor, text_cache_t& _text, aabb_t aabb, size_t notification_lines, size_t notification_columns, backend_t backend):
+        connection(_connection),
+        screen(_screen),
+        reactor(_reactor),
+        text(_text),
         window(connection, screen, aabb),
-        surface(connection, screen, window)
-    {}
+        surface(connection, screen, window, backend),
+        ring(notification_lines),
+        layouts(text.context, ring.slots.size()),
+        columns(notification_columns),
+        expiry(reactor, [this]() { expire(); })
+    {
+        uint32_t mask = XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK;
+        uint32_t values[] = {1, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_BUTTON_PRESS};
+        xcb_change_window_attributes(connection.connection, window.window, mask, values);
+    }
+
+    // returns the id the notification ended up under, which for a folded
+    // burst is the id of the notification it was folded into
+    uint32_t notify(const std::string& app, uint32_t replaces_id, const std::string& summary, const std::string& body, int32_t expire_timeout) {
+        auto now = clock::now();
+        size_t i = notification_ring_t::npos;
+        if (replaces_id != 0) {
+            i = ring.find([&](const notification_t& n) { return n.id == replaces_id; });
+        }
+        bool folded = false;
+        if (i == notification_ring_t::npos) {
+            i = ring.find([&](const notification_t& n) { return n.app == app && now - n.updated < burst; });
+            folded = i != notification_ring_t::npos;
+        }
+        if (i == notification_ring_t::npos) {
+            if (ring.full()) {
+                close(ring[0].id, undefined);
+            }
+            notification_t& n = ring.push_back();
+            n.id = next_id++;
+            if (next_id == 0) {
+                next_id = 1;
+            }
+            n.app.assign(app);
+            n.count = 0;
+            i = ring.size() - 1;
+        }
+        notification_t& n = ring[i];
+        n.summary.assign(summary);
+        truncate_utf8(n.summary, columns);
+        n.body.assign(body);
+        truncate_utf8(n.body, columns);
+        n.count = folded ? n.count + 1 : std::max<size_t>(n.count, 1);
+        n.updated = now;
+        n.version++;
+        if (expire_timeout == 0) {
+            n.expires = clock::time_point::max();
+        } else if (expire_timeout < 0) {
+            n.expires = now + timeout;
+        } else {
+            n.expires = now + std::chrono::milliseconds(expire_timeout);
+        }
+        changed();
+        return n.id;
+    }
+
+    void close(uint32_t id, reason_t reason) {
+        size_t i = ring.find([&](const notification_t& n) { return n.id == id; });
+        if (i == notification_ring_t::npos) {
+            return;
+        }
+        ring.erase(i);
+        if (on_closed) {
+            on_closed(id, reason);
+        }
+        changed();
+    }
+
     void redraw() {
-        // PangoContext* p = pango_cairo_create_context(surface.c->cobj());
-        PangoLayout* l0 = pango_cairo_create_layout(surface.c->cobj());
-        // pango_cairo_context_set_resolution(context, screen->dpi_y);
-    
-        // PangoLayout* l1 = pango_layout_new(p);
-        (void)l0;
-        // (void)l1;
-        // auto l = Pango::Layout::create(context);
-        std::string s;
-        {
-            size_t volume_pct = 90;
-            s = fmt::format("volume {volume_pct:3}%", fmt::arg("volume_pct", volume_pct));
-            std::string title = "title";
-            std::string body = "body";
-            s = fmt::format("<b>{title}</b>\n{body}", fmt::arg("title", title), fmt::arg("body", body));
-        }
-        PangoFontDescription* desc = pango_font_description_from_string("Hack 8");
-        pango_layout_set_font_description(l0, desc);
-        pango_font_description_free(desc);
-        // pango_layout_set_width(l0, 200);
-        // pango_layout_set_height(l0, 50);
-        // pango_layout_set_ellipsize(l0, PangoEllipsizeMode::PANGO_ELLIPSIZE_END);
-        pango_layout_set_text(l0, "text!", -1);
-        // pango_layout_set_markup(l0, s.c_str(), s.length());
-        cairo_move_to(surface.c->cobj(), 0, 0);
-        cairo_set_source_rgb(surface.c->cobj(), 1.0, 1.0, 1.0);
-        pango_cairo_show_layout(surface.c->cobj(), l0);
-        // l->set_width(200);
-        // l->set_height(50);
-        // l->set_ellipsize(Pango::EllipsizeMode::END);
-        // l->set_markup(Glib::ustring(s));
-        // l->add_to_cairo_context(surface.c);
-        // int notif_width = 200;
-        // aabb_t notifications_aabb = screen.aabb.chop(aabb_t::direction::right, notif_width);
-        // (void)notifications_aabb;
+        if (version == drawn_version && !exposed) {
+            return;
+        }
+        span_t span("notifications redraw", stats.notifications_redraw);
+        drawn_version = version;
+        exposed = false;
+        const auto& c = connection.connection;
+        if (ring.size() == 0) {
+            if (mapped) {
+                xcb_unmap_window(c, window.window);
+                mapped = false;
+            }
+            return;
+        }
+        surface.begin();
+        cairo_t* cr = surface.c->cobj();
+        cairo_set_source_rgb(cr, background[0], background[1], background[2]);
+        cairo_paint(cr);
+        cairo_set_source_rgb(cr, foreground[0], foreground[1], foreground[2]);
+        PangoFontDescription* desc = text.font(font, font_size);
+        layouts.begin(ring);
+        for (size_t row = 0; row < ring.size(); row++) {
+            PangoLayout* layout = layouts.get(ring[ring.size() - 1 - row], desc, window.aabb.width());
+            cairo_move_to(cr, 0, row * line_height);
+            pango_cairo_show_layout(cr, layout);
+        }
+        surface.present({aabb_t{0, 0, window.aabb.width(), window.aabb.height()}});
+        if (!mapped) {
+            xcb_map_window(c, window.window);
+            mapped = true;
+        }
+    }
+
+    // after the font or colours changed, also moves the window if its
+    // size changed with the font
+    void restyle(aabb_t aabb) {
+        layouts.clear();
+        if (aabb != window.aabb) {
+            window.move(aabb);
+            surface.resize();
+        }
+        changed();
+    }
+
+    // returns true if the window needs redrawing
+    bool handle_event(xcb_generic_event_t* event) {
+        switch (event->response_type & ~0x80) {
+            case XCB_EXPOSE:
+                if (reinterpret_cast<xcb_expose_event_t*>(event)->window != window.window) {
+                    return false;
+                }
+                exposed = true;
+                return true;
+            case XCB_BUTTON_PRESS:
+                {
+                    xcb_button_press_event_t& button_press = *reinterpret_cast<xcb_button_press_event_t*>(event);
+                    if (button_press.event != window.window) {
+                        return false;
+                    }
+                    size_t row = button_press.event_y / line_height;
+                    if (row < ring.size()) {
+                        close(ring[ring.size() - 1 - row].id, dismissed);
+                    }
+                    return true;
+                }
+            default:
+                return false;
+        }
+    }
+
+private:
+    void changed() {
+        version++;
+        reactor.request_frame();
+        schedule();
+    }
+
+    // one timer for the earliest deadline, however many notifications there are
+    void schedule() {
+        auto next = clock::time_point::max();
+        for (size_t i = 0; i < ring.size(); i++) {
+            next = std::min(next, ring[i].expires);
+        }
+        if (next == next_expiry) {
+            return;
+        }
+        next_expiry = next;
+        if (next == clock::time_point::max()) {
+            expiry.disarm();
+        } else {
+            expiry.arm(next);
+        }
+    }
+
+    void expire() {
+        next_expiry = clock::time_point::max();
+        auto now = clock::now();
+        for (size_t i = ring.size(); i-- > 0;) {
+            if (ring[i].expires <= now) {
+                close(ring[i].id, expired);
+            }
+        }
+        schedule();
+    }
+};
+
+// org.freedesktop.Notifications on the session bus, backed by notifications_t
+// throws sdbus::Error if another notification daemon already owns the name
+struct notification_server_t {
+    static constexpr const char* name = "org.freedesktop.Notifications";
+    static constexpr const char* path = "/org/freedesktop/Notifications";
+
+    notifications_t& notifications;
+    bus_t bus;
+    std::unique_ptr<sdbus::IObject> object;
+
+    notification_server_t(reactor_t& reactor, notifications_t& _notifications):
+        notifications(_notifications),
+        bus(reactor, sdbus::createSessionBusConnection(name)),
+        object(sdbus::createObject(*bus.connection, path))
+    {
+        object->registerMethod("Notify").onInterface(name).implementedAs([this](
+            const std::string& app_name,
+            uint32_t replaces_id,
+            const std::string& app_icon,
+            const std::string& summary,
+            const std::string& body,
+            const std::vector<std::string>& actions,
+            const std::map<std::string, sdbus::Variant>& hints,
+            int32_t expire_timeout
+        ) {
+            return notifications.notify(app_name, replaces_id, summary, body, expire_timeout);
+        });
+        object->registerMethod("CloseNotification").onInterface(name).implementedAs([this](uint32_t id) {
+            notifications.close(id, notifications_t::closed);
+        });
+        object->registerMethod("GetCapabilities").onInterface(name).implementedAs([]() {
+            return std::vector<std::string>{"body"};
+        });
+        object->registerMethod("GetServerInformation").onInterface(name).implementedAs([]() {
+            return std::make_tuple(std::string("ade"), std::string("ade"), std::string("0.1"), std::string("1.2"));
+        });
+        object->registerSignal("NotificationClosed").onInterface(name).withParameters<uint32_t, uint32_t>();
+        object->registerSignal("ActionInvoked").onInterface(name).withParameters<uint32_t, std::string>();
+        object->finishRegistration();
+
+        notifications.on_closed = [this](uint32_t id, uint32_t reason) {
+            object->emitSignal("NotificationClosed").onInterface(name).withArguments(id, reason);
+        };
+    }
+    ~notification_server_t() {
+        notifications.on_closed = nullptr;
     }
+    notification_server_t(const notification_server_t&) = delete;
+    notification_server_t& operator=(const notification_server_t&) = delete;
 };
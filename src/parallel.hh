@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// runs f(begin, end) over [0, n) cut into one range per thread, the last
+// one on the calling thread, and returns once every range is done
+// for short bursts of number crunching, e.g. over the rows of an image,
+// that are worth more than the ~50us starting the threads costs
+template <typename F>
+void parallel_for(size_t n, F&& f, size_t threads = std::thread::hardware_concurrency()) {
+    threads = std::clamp<size_t>(threads, 1, std::max<size_t>(n, 1));
+    std::vector<std::thread> workers;
+    size_t begin = 0;
+    for (size_t i = 0; i < threads; i++) {
+        size_t end = n * (i + 1) / threads;
+        if (i + 1 == threads) {
+            f(begin, end);
+        } else {
+            workers.emplace_back([&f, begin, end]() { f(begin, end); });
+        }
+        begin = end;
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// a command runs straight from argv when it has no shell syntax in it,
+// and only goes through /bin/sh -c when it needs to
+struct command_t {
+    std::string line;
+    std::vector<std::string> argv;
+
+    command_t() {}
+    command_t(std::string _line): line(std::move(_line)) {
+        if (line.find_first_of("|&;<>()$`\\\"'*?[]#~{}!\n") != std::string::npos) {
+            return;
+        }
+        std::istringstream words(line);
+        std::string word;
+        while (words >> word) {
+            argv.push_back(word);
+        }
+        // leading assignments like FOO=bar cmd need the shell too
+        if (!argv.empty() && argv.front().find('=') != std::string::npos) {
+            argv.clear();
+        }
+    }
+    command_t(std::vector<std::string> _argv): argv(std::move(_argv)) {
+        for (const auto& arg: argv) {
+            line += line.empty() ? arg : " " + arg;
+        }
+    }
+
+    bool empty() const {
+        return line.empty();
+    }
+    command_t with_argument(const std::string& arg) const {
+        command_t command = *this;
+        command.line += " " + arg;
+        if (!command.argv.empty()) {
+            command.argv.push_back(arg);
+        }
+        return command;
+    }
+
+    bool operator==(const command_t& x) const {
+        return line == x.line && argv == x.argv;
+    }
+    bool operator!=(const command_t& x) const {
+        return !(*this == x);
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const command_t& command) {
+        return out << command.line;
+    }
+};
+
+// starts a command in its own process group without going through the shell
+// where possible, the caller must reap it
+// with out, stdout goes to a pipe whose read end is stored there
+// with die_with_parent, the child is sent SIGTERM if ade goes away
+pid_t spawn(const command_t& command, int* out, bool die_with_parent) {
+    // everything the child touches is prepared up front, as a vfork child
+    // shares our memory and may only make syscalls before exec
+    std::vector<const char*> argv;
+    const char* file = "/bin/sh";
+    if (command.argv.empty()) {
+        argv = {"sh", "-c", command.line.c_str()};
+    } else {
+        for (const auto& arg: command.argv) {
+            argv.push_back(arg.c_str());
+        }
+        file = argv.front();
+    }
+    argv.push_back(nullptr);
+    sigset_t mask;
+    sigemptyset(&mask);
+
+    int fds[2] = {-1, -1};
+    if (out && pipe2(fds, O_CLOEXEC) == -1) {
+        std::cout << "pipe() failed!" << std::endl;
+        return -1;
+    }
+    pid_t pid = vfork();
+    if (pid == -1) {
+        std::cout << "vfork() failed!" << std::endl;
+        if (out) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        return -1;
+    }
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &mask, nullptr);
+        setpgid(0, 0);
+        if (die_with_parent) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+        }
+        if (out) {
+            dup2(fds[1], STDOUT_FILENO);
+        }
+        execvp(file, const_cast<char* const*>(argv.data()));
+        _exit(127);
+    }
+    if (out) {
+        close(fds[1]);
+        *out = fds[0];
+    }
+    return pid;
+}
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// module output is shown on one line, returns the cleaned up length
+size_t clean_output(char* data, size_t size) {
+    std::replace(data, data + size, '\n', ' ');
+    if (size > 0 && data[size - 1] == ' ') {
+        size--;
+    }
+    return size;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+// when each phase of startup began and how long it took, for --profile-startup
+// phases run on other threads are recorded in a profile of their own sharing
+// the same origin, and merged in once they are joined
+struct profile_t {
+    using clock = std::chrono::steady_clock;
+
+    struct phase_t {
+        std::string name;
+        clock::time_point begin;
+        clock::time_point end;
+    };
+
+    clock::time_point origin;
+    clock::time_point last;
+    std::vector<phase_t> phases;
+
+    profile_t(): origin(clock::now()), last(origin) {}
+    profile_t(clock::time_point _origin): origin(_origin), last(clock::now()) {}
+
+    // ends a phase that began where the previous one ended
+    void mark(std::string name) {
+        auto now = clock::now();
+        phases.push_back({std::move(name), last, now});
+        last = now;
+    }
+
+    void merge(const profile_t& other) {
+        phases.insert(phases.end(), other.phases.begin(), other.phases.end());
+    }
+
+    void print() {
+        std::sort(phases.begin(), phases.end(), [](const phase_t& a, const phase_t& b) {
+            return a.begin < b.begin;
+        });
+        const auto ms = [](clock::duration d) {
+            return std::chrono::duration<double, std::milli>(d).count();
+        };
+        std::printf("%10s %10s  %s\n", "start ms", "took ms", "phase");
+        for (const auto& phase: phases) {
+            std::printf("%10.3f %10.3f  %s\n", ms(phase.begin - origin), ms(phase.end - phase.begin), phase.name.c_str());
+        }
+        std::printf("%10.3f %10s  total\n", ms(last - origin), "");
+        std::fflush(stdout);
+    }
+};
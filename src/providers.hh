@@ -0,0 +1,522 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bar.hh"
+#include "reactor.hh"
+
+// built-in replacement for a module script, selected with type = "..."
+struct provider_t {
+    virtual ~provider_t() {}
+    // the module content right now
+    virtual std::string read() = 0;
+    // the same as typed fields, for modules with a format; only called
+    // right after read(), and built from what it read, so a value is read
+    // once per update; read() is always there as the field text
+    virtual fields_t fields() {
+        return {};
+    }
+    // becomes readable when the value may have changed, -1 to only poll
+    virtual int fd() {
+        return -1;
+    }
+    // consumes whatever made fd() readable, returns whether read() is worth calling
+    virtual bool changed() {
+        return true;
+    }
+};
+
+std::string pread_attribute(int fd) {
+    std::array<char, 64> buffer;
+    ssize_t n = pread(fd, buffer.data(), buffer.size(), 0);
+    if (n <= 0) {
+        return {};
+    }
+    std::string result(buffer.data(), n);
+    while (!result.empty() && result.back() == '\n') {
+        result.pop_back();
+    }
+    return result;
+}
+
+int open_attribute(const std::filesystem::path& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        std::cout << "could not open " << path << std::endl;
+    }
+    return fd;
+}
+
+// finds the first device in a /sys/class directory, optionally with a given type attribute
+std::string find_device(const std::string& class_dir, const std::string& type) {
+    std::error_code ec;
+    for (const auto& entry: std::filesystem::directory_iterator(class_dir, ec)) {
+        if (type.empty()) {
+            return entry.path().filename();
+        }
+        int fd = open((entry.path() / "type").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        bool match = pread_attribute(fd) == type;
+        close(fd);
+        if (match) {
+            return entry.path().filename();
+        }
+    }
+    return {};
+}
+
+// kernel uevents, filtered down to one device
+struct uevent_t {
+    int socket_fd = -1;
+    std::string devpath_suffix;
+
+    uevent_t(const std::string& subsystem, const std::string& device):
+        devpath_suffix("/" + subsystem + "/" + device)
+    {
+        socket_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        sockaddr_nl addr {};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1;
+        if (socket_fd != -1 && bind(socket_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            close(socket_fd);
+            socket_fd = -1;
+        }
+    }
+    ~uevent_t() {
+        if (socket_fd != -1) {
+            close(socket_fd);
+        }
+    }
+    uevent_t(const uevent_t&) = delete;
+    uevent_t& operator=(const uevent_t&) = delete;
+
+    // drains pending uevents, returns whether any were for our device
+    bool changed() {
+        std::array<char, 8192> buffer;
+        bool match = false;
+        while (true) {
+            ssize_t n = recv(socket_fd, buffer.data(), buffer.size() - 1, 0);
+            if (n <= 0) {
+                break;
+            }
+            buffer[n] = '\0';
+            // the header is "action@devpath"
+            std::string header(buffer.data());
+            size_t at = header.find('@');
+            if (at == std::string::npos) {
+                continue;
+            }
+            std::string devpath = header.substr(at + 1);
+            if (devpath.size() >= devpath_suffix.size() &&
+                devpath.compare(devpath.size() - devpath_suffix.size(), devpath_suffix.size(), devpath_suffix) == 0) {
+                match = true;
+            }
+        }
+        return match;
+    }
+};
+
+struct battery_t: provider_t {
+    int capacity_fd;
+    // as the last read() found it
+    std::string capacity;
+    uevent_t uevent;
+
+    battery_t(const std::string& device):
+        uevent("power_supply", device)
+    {
+        capacity_fd = open_attribute(std::filesystem::path("/sys/class/power_supply") / device / "capacity");
+    }
+    ~battery_t() {
+        if (capacity_fd != -1) {
+            close(capacity_fd);
+        }
+    }
+    std::string read() override {
+        if (capacity_fd == -1) {
+            return {};
+        }
+        capacity = pread_attribute(capacity_fd);
+        return "battery " + capacity + "%";
+    }
+    fields_t fields() override {
+        if (capacity_fd == -1) {
+            return {};
+        }
+        return {{"capacity", parse_value(capacity)}};
+    }
+    int fd() override {
+        return uevent.socket_fd;
+    }
+    bool changed() override {
+        return uevent.changed();
+    }
+};
+
+struct backlight_t: provider_t {
+    int brightness_fd;
+    double max_brightness = 1.0;
+    // as the last read() found it
+    long brightness = 0;
+    uevent_t uevent;
+
+    backlight_t(const std::string& device):
+        uevent("backlight", device)
+    {
+        std::filesystem::path dir = std::filesystem::path("/sys/class/backlight") / device;
+        brightness_fd = open_attribute(dir / "actual_brightness");
+        int max_fd = open_attribute(dir / "max_brightness");
+        if (max_fd != -1) {
+            max_brightness = std::max(1.0, std::atof(pread_attribute(max_fd).c_str()));
+            close(max_fd);
+        }
+    }
+    ~backlight_t() {
+        if (brightness_fd != -1) {
+            close(brightness_fd);
+        }
+    }
+    std::string read() override {
+        if (brightness_fd == -1) {
+            return {};
+        }
+        brightness = percent();
+        return "brightness " + std::to_string(brightness) + "%";
+    }
+    fields_t fields() override {
+        if (brightness_fd == -1) {
+            return {};
+        }
+        return {{"brightness", static_cast<int64_t>(brightness)}};
+    }
+    long percent() {
+        double brightness = std::atof(pread_attribute(brightness_fd).c_str());
+        return std::lround(100.0 * brightness / max_brightness);
+    }
+    int fd() override {
+        return uevent.socket_fd;
+    }
+    bool changed() override {
+        return uevent.changed();
+    }
+};
+
+// link and address state mirrored from rtnetlink, so reading it costs nothing
+struct network_t: provider_t {
+    struct link_t {
+        std::string name;
+        unsigned int flags;
+        bool wireless;
+    };
+    int socket_fd;
+    uint32_t sequence = 0;
+    std::map<int, link_t> links;
+    std::map<int, std::set<std::string>> addresses;
+
+    network_t() {
+        socket_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+        sockaddr_nl addr {};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if (socket_fd != -1 && bind(socket_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            close(socket_fd);
+            socket_fd = -1;
+        }
+        if (socket_fd == -1) {
+            std::cout << "could not open rtnetlink socket" << std::endl;
+            return;
+        }
+        dump(RTM_GETLINK);
+        dump(RTM_GETADDR);
+    }
+    ~network_t() {
+        if (socket_fd != -1) {
+            close(socket_fd);
+        }
+    }
+
+    std::string read() override {
+        std::string result;
+        for (const auto& [index, link]: links) {
+            if (!up(index, link)) {
+                continue;
+            }
+            if (!result.empty()) {
+                result += " ";
+            }
+            result += link.wireless ? "wifi " + link.name : "eth";
+        }
+        return result;
+    }
+    // the names of the links that are up, and whether one is wireless
+    fields_t fields() override {
+        std::string names;
+        bool wireless = false;
+        for (const auto& [index, link]: links) {
+            if (!up(index, link)) {
+                continue;
+            }
+            names += (names.empty() ? "" : " ") + link.name;
+            wireless = wireless || link.wireless;
+        }
+        return {{"links", names}, {"wireless", wireless}};
+    }
+    int fd() override {
+        return socket_fd;
+    }
+    bool changed() override {
+        bool any = false;
+        while (receive(MSG_DONTWAIT)) {
+            any = true;
+        }
+        return any;
+    }
+
+private:
+    bool up(int index, const link_t& link) {
+        bool up = (link.flags & IFF_UP) && (link.flags & IFF_LOWER_UP) && !(link.flags & IFF_LOOPBACK);
+        return up && !addresses[index].empty();
+    }
+
+    void dump(uint16_t type) {
+        struct {
+            nlmsghdr header;
+            rtgenmsg message;
+        } request {};
+        request.header.nlmsg_len = sizeof(request);
+        request.header.nlmsg_type = type;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = ++sequence;
+        request.message.rtgen_family = AF_UNSPEC;
+        if (send(socket_fd, &request, sizeof(request), 0) == -1) {
+            return;
+        }
+        while (receive(0) == 1) {}
+    }
+
+    // returns 0 when nothing was read, 2 at the end of a dump, 1 otherwise
+    int receive(int flags) {
+        alignas(nlmsghdr) std::array<char, 16384> buffer;
+        ssize_t n = recv(socket_fd, buffer.data(), buffer.size(), flags);
+        if (n <= 0) {
+            return 0;
+        }
+        int result = 1;
+        for (nlmsghdr* h = reinterpret_cast<nlmsghdr*>(buffer.data()); NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+            switch (h->nlmsg_type) {
+                case NLMSG_DONE:
+                case NLMSG_ERROR:
+                    result = 2;
+                    break;
+                case RTM_NEWLINK:
+                case RTM_DELLINK:
+                    {
+                        ifinfomsg* info = static_cast<ifinfomsg*>(NLMSG_DATA(h));
+                        if (h->nlmsg_type == RTM_DELLINK) {
+                            links.erase(info->ifi_index);
+                            addresses.erase(info->ifi_index);
+                            break;
+                        }
+                        link_t& link = links[info->ifi_index];
+                        link.flags = info->ifi_flags;
+                        int length = IFLA_PAYLOAD(h);
+                        for (rtattr* a = IFLA_RTA(info); RTA_OK(a, length); a = RTA_NEXT(a, length)) {
+                            if (a->rta_type == IFLA_IFNAME && link.name != static_cast<char*>(RTA_DATA(a))) {
+                                link.name = static_cast<char*>(RTA_DATA(a));
+                                link.wireless = std::filesystem::exists("/sys/class/net/" + link.name + "/wireless");
+                            }
+                        }
+                    }
+                    break;
+                case RTM_NEWADDR:
+                case RTM_DELADDR:
+                    {
+                        ifaddrmsg* info = static_cast<ifaddrmsg*>(NLMSG_DATA(h));
+                        int length = IFA_PAYLOAD(h);
+                        for (rtattr* a = IFA_RTA(info); RTA_OK(a, length); a = RTA_NEXT(a, length)) {
+                            if (a->rta_type != IFA_ADDRESS) {
+                                continue;
+                            }
+                            std::string address(static_cast<char*>(RTA_DATA(a)), RTA_PAYLOAD(a));
+                            if (h->nlmsg_type == RTM_NEWADDR) {
+                                addresses[info->ifa_index].insert(address);
+                            } else {
+                                addresses[info->ifa_index].erase(address);
+                            }
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        return result;
+    }
+};
+
+std::unique_ptr<provider_t> make_provider(const std::string& type, const std::string& device) {
+    if (type == "battery") {
+        return std::make_unique<battery_t>(device.empty() ? find_device("/sys/class/power_supply", "Battery") : device);
+    } else if (type == "backlight") {
+        return std::make_unique<backlight_t>(device.empty() ? find_device("/sys/class/backlight", "") : device);
+    } else if (type == "network") {
+        return std::make_unique<network_t>();
+    }
+    std::cout << "unknown module type " << type << std::endl;
+    return nullptr;
+}
+
+// owns the providers for every module with a type, and republishes a module
+// when its change notification fires or its interval elapses
+struct providers_t {
+    using clock = std::chrono::steady_clock;
+
+    struct slot_t {
+        size_t module;
+        std::unique_ptr<provider_t> provider;
+        std::unique_ptr<timerfd_t> interval;
+        // came due while paused
+        bool missed = false;
+    };
+
+    content_t& content;
+    reactor_t& reactor;
+    std::vector<std::unique_ptr<slot_t>> slots;
+    bool paused = false;
+
+    providers_t(content_t& _content, reactor_t& _reactor):
+        content(_content),
+        reactor(_reactor)
+    {
+        for (size_t i = 0; i < content.modules.size(); i++) {
+            add(i);
+        }
+    }
+    ~providers_t() {
+        for (auto& slot: slots) {
+            remove(*slot);
+        }
+    }
+
+    // follows content.replace(), moved says where each old module went
+    // providers of modules that moved are kept, those of modules that are
+    // gone are closed, and modules that are new get a provider
+    void reload(const std::vector<size_t>& moved) {
+        std::vector<bool> provided(content.modules.size(), false);
+        slots.erase(std::remove_if(slots.begin(), slots.end(), [&](std::unique_ptr<slot_t>& slot) {
+            size_t i = moved[slot->module];
+            if (i == content_t::npos) {
+                remove(*slot);
+                return true;
+            }
+            slot->module = i;
+            provided[i] = true;
+            return false;
+        }), slots.end());
+        for (size_t i = 0; i < content.modules.size(); i++) {
+            if (!provided[i]) {
+                add(i);
+            }
+        }
+    }
+
+    // reads a module's provider right away, without waiting for its interval
+    void refresh(size_t i) {
+        for (auto& slot: slots) {
+            if (slot->module == i) {
+                update(*slot);
+            }
+        }
+    }
+
+    // stops polling, like scheduler_t::pause(); changes providers are told
+    // about still come through, as they cost no wakeups of their own
+    void pause() {
+        paused = true;
+    }
+    void resume() {
+        if (!paused) {
+            return;
+        }
+        paused = false;
+        for (auto& slot: slots) {
+            if (slot->missed) {
+                slot->missed = false;
+                update(*slot);
+            }
+        }
+    }
+
+private:
+    void add(size_t i) {
+        const module_t& module = content.modules[i];
+        if (module.type.empty()) {
+            return;
+        }
+        auto provider = make_provider(module.type, module.device);
+        if (!provider) {
+            return;
+        }
+        auto slot = std::make_unique<slot_t>();
+        slot_t* s = slot.get();
+        s->module = i;
+        s->provider = std::move(provider);
+        s->interval = std::make_unique<timerfd_t>(reactor, [this, s]() {
+            if (paused) {
+                s->missed = true;
+                return;
+            }
+            update(*s);
+        });
+        if (s->provider->fd() != -1) {
+            reactor.add(s->provider->fd(), [this, s](uint32_t) {
+                if (s->provider->changed()) {
+                    update(*s);
+                }
+            });
+        }
+        slots.push_back(std::move(slot));
+        update(*s);
+    }
+
+    void remove(slot_t& slot) {
+        if (slot.provider->fd() != -1) {
+            reactor.remove(slot.provider->fd());
+        }
+    }
+
+    void update(slot_t& slot) {
+        module_t& module = content.modules[slot.module];
+        slot.interval->arm(reactor.align(clock::now() + module.interval));
+        bool changed;
+        if (module.formatter) {
+            std::string text = slot.provider->read();
+            fields_t fields = slot.provider->fields();
+            fields.emplace_back("text", std::move(text));
+            changed = content.publish(slot.module, fields);
+        } else {
+            changed = content.publish(slot.module, slot.provider->read());
+        }
+        if (changed) {
+            reactor.request_frame();
+        }
+    }
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "stats.hh"
+
+void arm_timerfd(int fd, std::chrono::steady_clock::time_point t) {
+    auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    itimerspec spec {};
+    spec.it_value.tv_sec = since_epoch / 1000000000;
+    spec.it_value.tv_nsec = since_epoch % 1000000000;
+    // an all-zero it_value would disarm the timer instead of firing it
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+// single-threaded event loop over file descriptors
+// redraws requested while handling a batch of events are coalesced into at
+// most one frame per frame_interval
+struct reactor_t {
+    using clock = std::chrono::steady_clock;
+    using handler_t = std::function<void(uint32_t)>;
+
+    int epoll_fd;
+    std::unordered_map<int, std::shared_ptr<handler_t>> handlers;
+    // run before every wait, in the order they were added, keyed by what
+    // add_idle() returned
+    std::map<uint64_t, std::shared_ptr<std::function<void()>>> idle;
+    std::function<void()> on_frame;
+    std::chrono::microseconds frame_interval {16667};
+    // timers armed through align() may be late by up to this much
+    std::chrono::milliseconds slack {0};
+
+    reactor_t() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        frame_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        add(frame_timer, [this](uint32_t) {
+            uint64_t expirations;
+            while (read(frame_timer, &expirations, sizeof(expirations)) > 0) {}
+            frame_armed = false;
+        });
+    }
+    ~reactor_t() {
+        close(frame_timer);
+        close(epoll_fd);
+    }
+    reactor_t(const reactor_t&) = delete;
+    reactor_t& operator=(const reactor_t&) = delete;
+
+    void add(int fd, handler_t handler, uint32_t events = EPOLLIN) {
+        epoll_event event {};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            std::cout << "epoll_ctl() failed!" << std::endl;
+            return;
+        }
+        handlers[fd] = std::make_shared<handler_t>(std::move(handler));
+    }
+    void modify(int fd, uint32_t events) {
+        epoll_event event {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+    // must be called before fd is closed
+    void remove(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        handlers.erase(fd);
+    }
+
+    // returns the key to remove it with
+    uint64_t add_idle(std::function<void()> hook) {
+        idle[next_idle] = std::make_shared<std::function<void()>>(std::move(hook));
+        return next_idle++;
+    }
+    void remove_idle(uint64_t key) {
+        idle.erase(key);
+    }
+
+    void request_frame() {
+        frame_requested = true;
+    }
+
+    // rounds a deadline up onto a grid of slack, so timers that come due
+    // around the same time share one wakeup instead of each having its own
+    // timerfds ignore the process' timer slack, hence doing it here
+    clock::time_point align(clock::time_point t) const {
+        if (slack.count() <= 0) {
+            return t;
+        }
+        clock::duration grid = slack;
+        clock::duration since_epoch = t.time_since_epoch();
+        return clock::time_point((since_epoch + grid - clock::duration(1)) / grid * grid);
+    }
+
+    void run() {
+        while (true) {
+            step();
+        }
+    }
+
+    // one round of idle hooks, a frame if one is due, and one batch of events
+    // waiting at most timeout milliseconds for them, or forever if negative
+    void step(int timeout = -1) {
+        std::array<epoll_event, 64> events;
+        {
+            span_t span("idle", stats.idle);
+            // looked up again after each, as a hook may remove others
+            uint64_t key = 0;
+            for (auto it = idle.begin(); it != idle.end(); it = idle.upper_bound(key)) {
+                key = it->first;
+                // keeps the hook alive if it removes itself
+                std::shared_ptr<std::function<void()>> hook = it->second;
+                (*hook)();
+            }
+        }
+        if (frame_requested) {
+            frame();
+        }
+        int n = epoll_wait(epoll_fd, events.data(), events.size(), timeout);
+        if (n == -1 && errno != EINTR) {
+            std::cout << "epoll_wait() failed!" << std::endl;
+            exit(1);
+        }
+        if (n <= 0) {
+            return;
+        }
+        stats.ready.add(static_cast<uint64_t>(n));
+        span_t span("handlers", stats.handlers);
+        for (int i = 0; i < n; i++) {
+            auto it = handlers.find(events[i].data.fd);
+            if (it == handlers.end()) {
+                continue;
+            }
+            // keeps the handler alive if it removes itself
+            std::shared_ptr<handler_t> handler = it->second;
+            (*handler)(events[i].events);
+        }
+    }
+
+private:
+    int frame_timer;
+    uint64_t next_idle = 0;
+    bool frame_requested = false;
+    bool frame_armed = false;
+    clock::time_point last_frame;
+
+    void frame() {
+        auto now = clock::now();
+        auto next = last_frame + frame_interval;
+        if (now >= next) {
+            frame_requested = false;
+            last_frame = now;
+            if (on_frame) {
+                span_t span("frame", stats.frame);
+                on_frame();
+            }
+        } else if (!frame_armed) {
+            arm_timerfd(frame_timer, next);
+            frame_armed = true;
+        }
+    }
+};
+
+// a one-shot timer on the reactor, steady_clock is CLOCK_MONOTONIC on linux
+struct timerfd_t {
+    reactor_t& reactor;
+    int fd;
+    std::function<void()> callback;
+
+    timerfd_t(reactor_t& _reactor, std::function<void()> _callback):
+        reactor(_reactor),
+        callback(std::move(_callback))
+    {
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        reactor.add(fd, [this](uint32_t) {
+            uint64_t expirations;
+            if (read(fd, &expirations, sizeof(expirations)) > 0) {
+                callback();
+            }
+        });
+    }
+    ~timerfd_t() {
+        reactor.remove(fd);
+        close(fd);
+    }
+    timerfd_t(const timerfd_t&) = delete;
+    timerfd_t& operator=(const timerfd_t&) = delete;
+
+    void arm(reactor_t::clock::time_point t) {
+        arm_timerfd(fd, t);
+    }
+    void disarm() {
+        itimerspec spec {};
+        timerfd_settime(fd, 0, &spec, nullptr);
+    }
+};
+
+// reaps every child centrally from a SIGCHLD signalfd and hands exit
+// statuses to whoever is watching that pid
+// must be constructed before any other thread is started, so that SIGCHLD
+// is blocked everywhere
+struct children_t {
+    reactor_t& reactor;
+    int fd;
+    std::unordered_map<pid_t, std::function<void(int)>> watching;
+
+    children_t(reactor_t& _reactor): reactor(_reactor) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+        fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        reactor.add(fd, [this](uint32_t) {
+            signalfd_siginfo info;
+            while (read(fd, &info, sizeof(info)) > 0) {}
+            reap();
+        });
+    }
+    ~children_t() {
+        reactor.remove(fd);
+        close(fd);
+    }
+    children_t(const children_t&) = delete;
+    children_t& operator=(const children_t&) = delete;
+
+    void watch(pid_t pid, std::function<void(int)> callback) {
+        watching[pid] = std::move(callback);
+    }
+
+private:
+    void reap() {
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto it = watching.find(pid);
+            if (it == watching.end()) {
+                continue;
+            }
+            auto callback = std::move(it->second);
+            watching.erase(it);
+            callback(status);
+        }
+    }
+};
@@ -1,25 +1,63 @@
 #pragma once
 
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/shm.h>
+
 #include <cairomm-1.16/cairomm/cairomm.h>
 #include <cairo/cairo.h>
 #include <cairo/cairo-xcb.h>
 #include <xcb/xcb.h>
+#include <xcb/shm.h>
+#include <xcb/randr.h>
+#include <xcb/screensaver.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xcb_atom.h>
+#include "area.hh"
 #include "atoms.hh"
-#include "cairomm/fontface.h"
-#include "cairomm/types.h"
 
+// every request startup needs a reply to is sent from the constructor, and
+// the replies are only waited for in collect(), so the round trips overlap
+// with each other and with whatever startup does in between
 struct connection_t {
     xcb_connection_t *connection;
+    xcb_ewmh_connection_t ewmh;
+    xcb_intern_atom_cookie_t *ewmh_cookie;
     connection_t() {
         connection = xcb_connect(NULL, NULL);
-        cache_atoms(connection);
+        if (xcb_connection_has_error(connection)) {
+            std::cout << "xcb_connect() failed!" << std::endl;
+            exit(1);
+        }
+        request_atoms(connection);
+        ewmh_cookie = xcb_ewmh_init_atoms(connection, &ewmh);
+        xcb_prefetch_extension_data(connection, &xcb_shm_id);
+        xcb_prefetch_extension_data(connection, &xcb_randr_id);
+        xcb_prefetch_extension_data(connection, &xcb_screensaver_id);
     }
     ~connection_t() {
+        xcb_ewmh_connection_wipe(&ewmh);
         xcb_disconnect(connection);
     }
+    connection_t(const connection_t&) = delete;
+    connection_t& operator=(const connection_t&) = delete;
+
+    void collect() {
+        collect_atoms(connection);
+        xcb_ewmh_init_atoms_replies(&ewmh, ewmh_cookie, nullptr);
+    }
+};
+
+// a monitor, or several showing the same picture
+struct output_t {
+    std::string name;
+    aabb_t aabb;
+    bool primary = false;
 };
 
 struct screen_t {
@@ -27,10 +65,21 @@ struct screen_t {
     xcb_screen_t *screen;
     xcb_visualtype_t *visual_type;
     double dpi_x, dpi_y;
+    xcb_window_t bottom = 0;
+    xcb_query_tree_cookie_t tree;
+    std::vector<output_t> outputs;
+    // the number of randr's first event, 0 without randr
+    uint8_t randr_event = 0;
+    xcb_get_geometry_cookie_t geometry;
+    xcb_randr_query_version_cookie_t randr_version;
+    xcb_randr_get_screen_resources_current_cookie_t resources;
+    xcb_randr_get_output_primary_cookie_t primary;
     screen_t(connection_t& connection) {
         xcb_screen_iterator_t iter = xcb_setup_roots_iterator(xcb_get_setup(connection.connection));
         screen = iter.data;
+        tree = xcb_query_tree(connection.connection, screen->root);
         aabb = {0, 0, screen->width_in_pixels, screen->height_in_pixels};
+        request_outputs(connection);
 
         dpi_x = (static_cast<double>(screen->width_in_pixels) * 25.4 / static_cast<double>(screen->width_in_millimeters));
         dpi_y = (static_cast<double>(screen->height_in_pixels) * 25.4 / static_cast<double>(screen->height_in_millimeters));
@@ -46,10 +95,113 @@ struct screen_t {
             }
         }
     }
+
+    // finds the bottom-most child of the root, e.g. a desktop window, which
+    // docks are stacked relative to, and the outputs
+    void collect(connection_t& connection) {
+        xcb_query_tree_reply_t *reply = xcb_query_tree_reply(connection.connection, tree, nullptr);
+        if (reply) {
+            if (xcb_query_tree_children_length(reply) > 0) {
+                bottom = xcb_query_tree_children(reply)[0];
+            }
+            free(reply);
+        }
+        collect_outputs(connection);
+    }
+
+    // asks for the size of the root and for the outputs, which are only
+    // waited for in collect_outputs(); again after every screen change
+    void request_outputs(connection_t& connection) {
+        const auto& c = connection.connection;
+        geometry = xcb_get_geometry(c, screen->root);
+        // waits for the reply to the prefetch sent along with the atoms
+        const xcb_query_extension_reply_t* extension = xcb_get_extension_data(c, &xcb_randr_id);
+        if (!extension || !extension->present) {
+            return;
+        }
+        randr_event = extension->first_event;
+        randr_version = xcb_randr_query_version(c, XCB_RANDR_MAJOR_VERSION, XCB_RANDR_MINOR_VERSION);
+        resources = xcb_randr_get_screen_resources_current(c, screen->root);
+        primary = xcb_randr_get_output_primary(c, screen->root);
+    }
+
+    // one output per active crtc, so mirrored monitors get a single bar
+    // without randr, or with nothing lit, the whole root is one output
+    void collect_outputs(connection_t& connection) {
+        const auto& c = connection.connection;
+        xcb_get_geometry_reply_t* root = xcb_get_geometry_reply(c, geometry, nullptr);
+        if (root) {
+            aabb = {0, 0, root->width, root->height};
+            free(root);
+        }
+        outputs.clear();
+        if (randr_event) {
+            free(xcb_randr_query_version_reply(c, randr_version, nullptr));
+            xcb_randr_get_output_primary_reply_t* primary_reply = xcb_randr_get_output_primary_reply(c, primary, nullptr);
+            xcb_randr_output_t primary_output = primary_reply ? primary_reply->output : XCB_NONE;
+            free(primary_reply);
+            xcb_randr_get_screen_resources_current_reply_t* reply = xcb_randr_get_screen_resources_current_reply(c, resources, nullptr);
+            if (reply) {
+                collect_crtcs(c, reply, primary_output);
+                free(reply);
+            }
+        }
+        if (outputs.empty()) {
+            outputs.push_back(output_t{"root", aabb, true});
+        }
+        if (std::none_of(outputs.begin(), outputs.end(), [](const output_t& output) { return output.primary; })) {
+            outputs.front().primary = true;
+        }
+    }
+
+private:
+    // every crtc and output is asked about at once, so this is one round trip
+    void collect_crtcs(xcb_connection_t* c, xcb_randr_get_screen_resources_current_reply_t* reply, xcb_randr_output_t primary_output) {
+        xcb_timestamp_t timestamp = reply->config_timestamp;
+        const xcb_randr_crtc_t* crtc_ids = xcb_randr_get_screen_resources_current_crtcs(reply);
+        std::vector<xcb_randr_get_crtc_info_cookie_t> crtc_cookies(xcb_randr_get_screen_resources_current_crtcs_length(reply));
+        for (size_t i = 0; i < crtc_cookies.size(); i++) {
+            crtc_cookies[i] = xcb_randr_get_crtc_info(c, crtc_ids[i], timestamp);
+        }
+        const xcb_randr_output_t* output_ids = xcb_randr_get_screen_resources_current_outputs(reply);
+        std::vector<xcb_randr_get_output_info_cookie_t> output_cookies(xcb_randr_get_screen_resources_current_outputs_length(reply));
+        for (size_t i = 0; i < output_cookies.size(); i++) {
+            output_cookies[i] = xcb_randr_get_output_info(c, output_ids[i], timestamp);
+        }
+
+        std::map<xcb_randr_crtc_t, aabb_t> crtcs;
+        for (size_t i = 0; i < crtc_cookies.size(); i++) {
+            xcb_randr_get_crtc_info_reply_t* crtc = xcb_randr_get_crtc_info_reply(c, crtc_cookies[i], nullptr);
+            if (crtc && crtc->mode != XCB_NONE && crtc->width > 0 && crtc->height > 0) {
+                crtcs[crtc_ids[i]] = aabb_t{crtc->x, crtc->y, crtc->width, crtc->height};
+            }
+            free(crtc);
+        }
+        // where each crtc's output went
+        std::map<xcb_randr_crtc_t, size_t> used;
+        for (size_t i = 0; i < output_cookies.size(); i++) {
+            xcb_randr_get_output_info_reply_t* info = xcb_randr_get_output_info_reply(c, output_cookies[i], nullptr);
+            if (!info) {
+                continue;
+            }
+            auto crtc = crtcs.find(info->crtc);
+            if (info->connection == XCB_RANDR_CONNECTION_CONNECTED && crtc != crtcs.end()) {
+                auto [it, added] = used.try_emplace(info->crtc, outputs.size());
+                if (added) {
+                    const char* name = reinterpret_cast<const char*>(xcb_randr_get_output_info_name(info));
+                    outputs.push_back(output_t{std::string(name, xcb_randr_get_output_info_name_length(info)), crtc->second, false});
+                }
+                if (output_ids[i] == primary_output) {
+                    outputs[it->second].primary = true;
+                }
+            }
+            free(info);
+        }
+    }
 };
 
 struct window_t {
-    connection_t connection;
+    connection_t& connection;
     xcb_drawable_t window;
     aabb_t aabb;
 
@@ -69,24 +221,214 @@ struct window_t {
     ~window_t() {
         xcb_destroy_window(connection.connection, window);
     }
+    window_t(const window_t&) = delete;
+    window_t& operator=(const window_t&) = delete;
+
+    void move(aabb_t aabb_) {
+        aabb = aabb_;
+        uint16_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+        uint32_t values[] = {
+            static_cast<uint32_t>(aabb.xpos()), static_cast<uint32_t>(aabb.ypos()),
+            static_cast<uint32_t>(aabb.width()), static_cast<uint32_t>(aabb.height()),
+        };
+        xcb_configure_window(connection.connection, window, mask, values);
+    }
+};
+
+// direct draws straight onto the window, shm and pixmap draw into a back
+// buffer (client-side shared memory, or a server-side pixmap when shm is
+// unavailable) and only copy the damaged rectangles to the window
+enum class backend_t {
+    direct, shm, pixmap,
 };
 
+backend_t parse_backend(const std::string& name) {
+    if (name == "direct") {
+        return backend_t::direct;
+    } else if (name == "shm") {
+        return backend_t::shm;
+    } else if (name == "pixmap") {
+        return backend_t::pixmap;
+    }
+    std::cout << "unknown backend " << name << std::endl;
+    abort();
+}
+
 struct surface_t {
-    Cairo::Surface s;
+    connection_t& connection;
+    screen_t& screen;
+    window_t& window;
+    backend_t backend;
+    xcb_gcontext_t gc = 0;
+    xcb_pixmap_t pixmap = 0;
+    xcb_shm_seg_t segment = 0;
+    uint8_t depth = 0;
+    void* data = nullptr;
+    bool in_flight = false;
+    xcb_get_input_focus_cookie_t presented;
+    std::unique_ptr<Cairo::Surface> s;
     std::shared_ptr<Cairo::Context> c;
 
-    surface_t(connection_t& connection, screen_t& screen, window_t& window):
-        s(cairo_xcb_surface_create(connection.connection, window.window, screen.visual_type, window.aabb.width(), window.aabb.height())),
-        c(std::make_shared<Cairo::Context>(cairo_create(s.cobj())))
-    {}
-};
+    surface_t(connection_t& _connection, screen_t& _screen, window_t& _window, backend_t _backend = backend_t::direct):
+        connection(_connection),
+        screen(_screen),
+        window(_window),
+        backend(_backend)
+    {
+        resize();
+    }
+    ~surface_t() {
+        release();
+    }
+    surface_t(const surface_t&) = delete;
+    surface_t& operator=(const surface_t&) = delete;
 
-Cairo::FontExtents calculate_font_extents(std::string font, double font_size) {
-    Cairo::Surface s(cairo_image_surface_create(cairo_format_t{}, 0, 0));
-    Cairo::Context c(cairo_create(s.cobj()));
-    c.select_font_face(font, Cairo::ToyFontFace::Slant::NORMAL, Cairo::ToyFontFace::Weight::NORMAL);
-    c.set_font_size(font_size);
-    Cairo::FontExtents font_extents;
-    c.get_font_extents(font_extents);
-    return font_extents;
-}
+    // call before drawing, so the server has finished reading the shared
+    // memory of the previous frame before it is overwritten
+    void begin() {
+        if (in_flight) {
+            free(xcb_get_input_focus_reply(connection.connection, presented, nullptr));
+            in_flight = false;
+        }
+    }
+
+    // pushes the damaged rectangles of the back buffer to the window
+    void present(const std::vector<aabb_t>& damage) {
+        const auto& conn = connection.connection;
+        const auto& w = window.window;
+        s->flush();
+        switch (backend) {
+            case backend_t::direct:
+                break;
+            case backend_t::shm:
+                for (auto rect: damage) {
+                    rect = clamp(rect);
+                    if (rect.width() <= 0 || rect.height() <= 0) {
+                        continue;
+                    }
+                    xcb_shm_put_image(
+                        conn, w, gc,
+                        window.aabb.width(), window.aabb.height(),
+                        rect.x0, rect.y0, rect.width(), rect.height(),
+                        rect.x0, rect.y0,
+                        depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 0, segment, 0
+                    );
+                }
+                presented = xcb_get_input_focus(conn);
+                in_flight = true;
+                break;
+            case backend_t::pixmap:
+                if (!damage.empty()) {
+                    aabb_t bounds = damage.front();
+                    for (const auto& rect: damage) {
+                        bounds.x0 = std::min(bounds.x0, rect.x0);
+                        bounds.y0 = std::min(bounds.y0, rect.y0);
+                        bounds.x1 = std::max(bounds.x1, rect.x1);
+                        bounds.y1 = std::max(bounds.y1, rect.y1);
+                    }
+                    bounds = clamp(bounds);
+                    xcb_copy_area(conn, pixmap, w, gc, bounds.x0, bounds.y0, bounds.x0, bounds.y0, bounds.width(), bounds.height());
+                }
+                break;
+        }
+        xcb_flush(conn);
+    }
+
+    // recreates the back buffer at the window's current size
+    void resize() {
+        release();
+        s = std::make_unique<Cairo::Surface>(create());
+        c = std::make_shared<Cairo::Context>(cairo_create(s->cobj()));
+    }
+
+private:
+    void release() {
+        const auto& conn = connection.connection;
+        if (in_flight) {
+            free(xcb_get_input_focus_reply(conn, presented, nullptr));
+            in_flight = false;
+        }
+        c.reset();
+        s.reset();
+        if (segment) {
+            xcb_shm_detach(conn, segment);
+            shmdt(data);
+            segment = 0;
+            data = nullptr;
+        }
+        if (pixmap) {
+            xcb_free_pixmap(conn, pixmap);
+            pixmap = 0;
+        }
+        if (gc) {
+            xcb_free_gc(conn, gc);
+            gc = 0;
+        }
+    }
+
+    aabb_t clamp(aabb_t rect) {
+        rect.x0 = std::clamp(rect.x0, 0, window.aabb.width());
+        rect.x1 = std::clamp(rect.x1, 0, window.aabb.width());
+        rect.y0 = std::clamp(rect.y0, 0, window.aabb.height());
+        rect.y1 = std::clamp(rect.y1, 0, window.aabb.height());
+        return rect;
+    }
+
+    cairo_surface_t* create() {
+        const auto& conn = connection.connection;
+        int width = window.aabb.width();
+        int height = window.aabb.height();
+        depth = screen.screen->root_depth;
+        if (backend != backend_t::direct) {
+            gc = xcb_generate_id(conn);
+            uint32_t exposures = 0;
+            xcb_create_gc(conn, gc, window.window, XCB_GC_GRAPHICS_EXPOSURES, &exposures);
+        }
+        if (backend == backend_t::shm) {
+            cairo_surface_t* surface = create_shm(width, height);
+            if (surface) {
+                return surface;
+            }
+            std::cout << "MIT-SHM unavailable, falling back to a pixmap" << std::endl;
+            backend = backend_t::pixmap;
+        }
+        if (backend == backend_t::pixmap) {
+            pixmap = xcb_generate_id(conn);
+            xcb_create_pixmap(conn, depth, pixmap, window.window, width, height);
+            return cairo_xcb_surface_create(conn, pixmap, screen.visual_type, width, height);
+        }
+        return cairo_xcb_surface_create(conn, window.window, screen.visual_type, width, height);
+    }
+
+    cairo_surface_t* create_shm(int width, int height) {
+        const auto& conn = connection.connection;
+        const xcb_query_extension_reply_t* extension = xcb_get_extension_data(conn, &xcb_shm_id);
+        if (!extension || !extension->present || (depth != 24 && depth != 32)) {
+            return nullptr;
+        }
+        cairo_format_t format = depth == 32 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+        int stride = cairo_format_stride_for_width(format, width);
+        int shmid = shmget(IPC_PRIVATE, static_cast<size_t>(stride) * height, IPC_CREAT | 0600);
+        if (shmid == -1) {
+            return nullptr;
+        }
+        data = shmat(shmid, nullptr, 0);
+        if (data == reinterpret_cast<void*>(-1)) {
+            data = nullptr;
+            shmctl(shmid, IPC_RMID, nullptr);
+            return nullptr;
+        }
+        segment = xcb_generate_id(conn);
+        xcb_generic_error_t* error = xcb_request_check(conn, xcb_shm_attach_checked(conn, segment, shmid, false));
+        // the segment goes away once both sides have detached
+        shmctl(shmid, IPC_RMID, nullptr);
+        if (error) {
+            free(error);
+            shmdt(data);
+            data = nullptr;
+            segment = 0;
+            return nullptr;
+        }
+        return cairo_image_surface_create_for_data(static_cast<unsigned char*>(data), format, width, height, stride);
+    }
+};
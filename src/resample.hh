@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "parallel.hh"
+#include "simd.hh"
+
+// scaling xrgb images to any size, laid out as in blur.hh
+// each output pixel is a weighted sum of the source pixels under a triangle
+// centred on it, which is bilinear when enlarging and is stretched by the
+// scale when shrinking, so every source pixel counts; the image is scaled
+// along rows first, into a temporary image, and then down its columns
+
+// for each output pixel along one axis, the first source pixel it reads
+// and a weight for each of the next count; windows near the edges are
+// moved inwards rather than cut short, so every pixel has count taps
+struct taps_t {
+    std::vector<uint32_t> first;
+    size_t count = 0;
+    std::vector<float> weights;
+};
+
+// maps out pixels onto [from, from + length) of an axis size pixels long
+taps_t make_taps(size_t size, double from, double length, size_t out) {
+    const double scale = length / out;
+    const double support = std::max(scale, 1.0);
+    taps_t taps;
+    taps.count = std::min<size_t>(2 * static_cast<size_t>(std::ceil(support)) + 1, size);
+    taps.first.resize(out);
+    taps.weights.resize(out * taps.count);
+    for (size_t i = 0; i < out; i++) {
+        double centre = from + (i + 0.5) * scale;
+        double first = std::floor(centre - support);
+        size_t start = static_cast<size_t>(std::clamp(first, 0.0, static_cast<double>(size - taps.count)));
+        float* weights = &taps.weights[i * taps.count];
+        double total = 0;
+        for (size_t k = 0; k < taps.count; k++) {
+            double distance = std::abs(start + k + 0.5 - centre) / support;
+            weights[k] = static_cast<float>(std::max(0.0, 1.0 - distance));
+            total += weights[k];
+        }
+        // only when the whole triangle fell outside the image
+        if (total == 0) {
+            size_t nearest = static_cast<size_t>(std::clamp(centre, static_cast<double>(start), static_cast<double>(start + taps.count - 1))) - start;
+            weights[nearest] = 1;
+            total = 1;
+        }
+        for (size_t k = 0; k < taps.count; k++) {
+            weights[k] = static_cast<float>(weights[k] / total);
+        }
+        taps.first[i] = start;
+    }
+    return taps;
+}
+
+uint32_t round_pixel(const float sums[4]) {
+    uint32_t pixel = 0;
+    for (int c = 0; c < 4; c++) {
+        pixel |= static_cast<uint32_t>(std::clamp(std::nearbyint(sums[c]), 0.0f, 255.0f)) << (8 * c);
+    }
+    return pixel;
+}
+
+// rows y0 to y1 of src, scaled to width into the same rows of dst
+void resample_rows_scalar(const uint32_t* src, size_t src_stride, const taps_t& taps, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* row = src + y * src_stride;
+        for (size_t x = 0; x < width; x++) {
+            const uint32_t* in = row + taps.first[x];
+            const float* weights = &taps.weights[x * taps.count];
+            float sums[4] = {};
+            for (size_t k = 0; k < taps.count; k++) {
+                for (int c = 0; c < 4; c++) {
+                    sums[c] += weights[k] * ((in[k] >> (8 * c)) & 0xff);
+                }
+            }
+            dst[y * width + x] = round_pixel(sums);
+        }
+    }
+}
+
+// rows y0 to y1 of dst, each from the rows of src its taps pick, src
+// starting at row `from` of what the taps count in
+void resample_columns_scalar(const uint32_t* src, const taps_t& taps, size_t from, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* rows = src + (taps.first[y] - from) * width;
+        const float* weights = &taps.weights[y * taps.count];
+        for (size_t x = 0; x < width; x++) {
+            float sums[4] = {};
+            for (size_t k = 0; k < taps.count; k++) {
+                uint32_t pixel = rows[k * width + x];
+                for (int c = 0; c < 4; c++) {
+                    sums[c] += weights[k] * ((pixel >> (8 * c)) & 0xff);
+                }
+            }
+            dst[y * width + x] = round_pixel(sums);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+// a pixel's channels as floats, and back, rounded and saturated
+__m128 unpack_ps(uint32_t pixel) {
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero));
+}
+uint32_t pack_ps(__m128 sums) {
+    __m128i v = _mm_cvtps_epi32(sums);
+    v = _mm_packs_epi32(v, v);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+}
+
+// a pixel, its four channels, per vector
+void resample_rows_sse2(const uint32_t* src, size_t src_stride, const taps_t& taps, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* row = src + y * src_stride;
+        for (size_t x = 0; x < width; x++) {
+            const uint32_t* in = row + taps.first[x];
+            const float* weights = &taps.weights[x * taps.count];
+            __m128 sums = _mm_setzero_ps();
+            for (size_t k = 0; k < taps.count; k++) {
+                sums = _mm_add_ps(sums, _mm_mul_ps(unpack_ps(in[k]), _mm_set1_ps(weights[k])));
+            }
+            dst[y * width + x] = pack_ps(sums);
+        }
+    }
+}
+
+void resample_columns_sse2(const uint32_t* src, const taps_t& taps, size_t from, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* rows = src + (taps.first[y] - from) * width;
+        const float* weights = &taps.weights[y * taps.count];
+        for (size_t x = 0; x < width; x++) {
+            __m128 sums = _mm_setzero_ps();
+            for (size_t k = 0; k < taps.count; k++) {
+                sums = _mm_add_ps(sums, _mm_mul_ps(unpack_ps(rows[k * width + x]), _mm_set1_ps(weights[k])));
+            }
+            dst[y * width + x] = pack_ps(sums);
+        }
+    }
+}
+
+// two pixels' channels as floats, and back
+__attribute__((target("avx2")))
+__m256 unpack2_ps(const uint32_t* pixels) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels))));
+}
+__attribute__((target("avx2")))
+void pack2_ps(__m256 sums, uint32_t* pixels) {
+    __m256i v = _mm256_cvtps_epi32(sums);
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pixels), _mm_packus_epi16(packed, packed));
+}
+
+// two taps of a pixel per vector, the halves summed at the end
+__attribute__((target("avx2")))
+void resample_rows_avx2(const uint32_t* src, size_t src_stride, const taps_t& taps, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* row = src + y * src_stride;
+        for (size_t x = 0; x < width; x++) {
+            const uint32_t* in = row + taps.first[x];
+            const float* weights = &taps.weights[x * taps.count];
+            __m256 pairs = _mm256_setzero_ps();
+            size_t k = 0;
+            for (; k + 2 <= taps.count; k += 2) {
+                __m256 w = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weights[k])), _mm_set1_ps(weights[k + 1]), 1);
+                pairs = _mm256_add_ps(pairs, _mm256_mul_ps(unpack2_ps(in + k), w));
+            }
+            __m128 sums = _mm_add_ps(_mm256_castps256_ps128(pairs), _mm256_extractf128_ps(pairs, 1));
+            if (k < taps.count) {
+                sums = _mm_add_ps(sums, _mm_mul_ps(unpack_ps(in[k]), _mm_set1_ps(weights[k])));
+            }
+            dst[y * width + x] = pack_ps(sums);
+        }
+    }
+}
+
+// two neighbouring pixels per vector
+__attribute__((target("avx2")))
+void resample_columns_avx2(const uint32_t* src, const taps_t& taps, size_t from, uint32_t* dst, size_t width, size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+        const uint32_t* rows = src + (taps.first[y] - from) * width;
+        const float* weights = &taps.weights[y * taps.count];
+        size_t x = 0;
+        for (; x + 2 <= width; x += 2) {
+            __m256 sums = _mm256_setzero_ps();
+            for (size_t k = 0; k < taps.count; k++) {
+                sums = _mm256_add_ps(sums, _mm256_mul_ps(unpack2_ps(rows + k * width + x), _mm256_set1_ps(weights[k])));
+            }
+            pack2_ps(sums, dst + y * width + x);
+        }
+        for (; x < width; x++) {
+            __m128 sums = _mm_setzero_ps();
+            for (size_t k = 0; k < taps.count; k++) {
+                sums = _mm_add_ps(sums, _mm_mul_ps(unpack_ps(rows[k * width + x]), _mm_set1_ps(weights[k])));
+            }
+            dst[y * width + x] = pack_ps(sums);
+        }
+    }
+}
+#endif
+
+// scales the part of src at x, y, width × height, in source pixels, to
+// dst, which is dst_width × dst_height and packed; rows are split between
+// threads for both passes
+void resample(const uint32_t* src, size_t src_width, size_t src_height, size_t src_stride,
+    double x, double y, double width, double height,
+    uint32_t* dst, size_t dst_width, size_t dst_height,
+    simd_t simd = best_simd(), size_t threads = std::thread::hardware_concurrency()) {
+    if (src_width == 0 || src_height == 0 || dst_width == 0 || dst_height == 0) {
+        return;
+    }
+    const taps_t across = make_taps(src_width, x, width, dst_width);
+    const taps_t down = make_taps(src_height, y, height, dst_height);
+    // only the source rows some output row reads are scaled across
+    const size_t from = down.first.front();
+    const size_t to = down.first.back() + down.count;
+    std::vector<uint32_t> temp(dst_width * (to - from));
+    const uint32_t* rows = src + from * src_stride;
+    parallel_for(to - from, [&](size_t y0, size_t y1) {
+        switch (simd) {
+#if defined(__x86_64__)
+            case simd_t::avx2:
+                resample_rows_avx2(rows, src_stride, across, temp.data(), dst_width, y0, y1);
+                return;
+            case simd_t::sse2:
+                resample_rows_sse2(rows, src_stride, across, temp.data(), dst_width, y0, y1);
+                return;
+#endif
+            default:
+                resample_rows_scalar(rows, src_stride, across, temp.data(), dst_width, y0, y1);
+                return;
+        }
+    }, threads);
+    parallel_for(dst_height, [&](size_t y0, size_t y1) {
+        switch (simd) {
+#if defined(__x86_64__)
+            case simd_t::avx2:
+                resample_columns_avx2(temp.data(), down, from, dst, dst_width, y0, y1);
+                return;
+            case simd_t::sse2:
+                resample_columns_sse2(temp.data(), down, from, dst, dst_width, y0, y1);
+                return;
+#endif
+            default:
+                resample_columns_scalar(temp.data(), down, from, dst, dst_width, y0, y1);
+                return;
+        }
+    }, threads);
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bar.hh"
+#include "process.hh"
+#include "reactor.hh"
+#include "stats.hh"
+
+// runs each exec module on its own interval, with at most max_jobs children
+// at once, all driven from the reactor
+// a module is only ever queued or running once, and its output is only
+// published after the child has exited
+struct scheduler_t {
+    using clock = std::chrono::steady_clock;
+
+    // as much as a module may print in one run, the same as streams_t's
+    // max_line; one that prints more is killed and counted as failed
+    static constexpr size_t max_output = 64 * 1024;
+
+    struct job_t {
+        size_t module;
+        std::unique_ptr<timerfd_t> interval;
+        std::unique_ptr<timerfd_t> timeout;
+        pid_t pid = -1;
+        // the child's process group, which outlives the child while anything
+        // it started, e.g. with `cmd &`, still runs
+        pid_t pgid = -1;
+        int fd = -1;
+        // reused between runs, and only grown when a module prints more than it holds
+        std::vector<char> output = std::vector<char>(16384);
+        size_t used = 0;
+        clock::time_point start;
+        bool active = false;
+        bool queued = false;
+        bool pending = false;
+        bool timed_out = false;
+        // printed more than max_output, and was killed for it
+        bool overflowed = false;
+        int status = 0;
+        // its module went away in a reload, it is dropped once its child is gone
+        bool retired = false;
+        // came due while paused
+        bool missed = false;
+    };
+
+    content_t& content;
+    reactor_t& reactor;
+    children_t& children;
+    size_t max_jobs;
+    size_t running = 0;
+    std::vector<std::unique_ptr<job_t>> jobs;
+    std::vector<job_t*> by_module;
+    std::deque<job_t*> waiting;
+    bool paused = false;
+
+    scheduler_t(content_t& _content, reactor_t& _reactor, children_t& _children, size_t _max_jobs):
+        content(_content),
+        reactor(_reactor),
+        children(_children),
+        max_jobs(std::max<size_t>(1, _max_jobs)),
+        by_module(content.modules.size(), nullptr)
+    {
+        for (size_t i = 0; i < content.modules.size(); i++) {
+            add(i);
+        }
+    }
+
+    // follows content.replace(), moved says where each old module went
+    // jobs of modules that moved keep running, jobs of modules that are gone
+    // are killed, and modules that are new get a job started
+    // set max_jobs first, so queued jobs start if it went up
+    void reload(const std::vector<size_t>& moved) {
+        jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [](const std::unique_ptr<job_t>& job) {
+            return job->retired && !job->active;
+        }), jobs.end());
+        by_module.assign(content.modules.size(), nullptr);
+        for (auto& job: jobs) {
+            if (job->retired) {
+                continue;
+            }
+            size_t i = moved[job->module];
+            if (i == content_t::npos) {
+                retire(*job);
+                continue;
+            }
+            job->module = i;
+            by_module[i] = job.get();
+        }
+        for (size_t i = 0; i < content.modules.size(); i++) {
+            if (!by_module[i]) {
+                add(i);
+            }
+        }
+        // max_jobs may have been raised
+        start_waiting();
+    }
+
+    // run a module as soon as possible, without waiting for its interval
+    void refresh(size_t i) {
+        job_t* job = i < by_module.size() ? by_module[i] : nullptr;
+        if (!job) {
+            return;
+        }
+        if (job->active) {
+            job->pending = true;
+            return;
+        }
+        due(*job);
+    }
+
+    // while nobody can see the bar no module is started, and every module
+    // that came due in the meantime is run once on resume
+    void pause() {
+        paused = true;
+    }
+    void resume() {
+        if (!paused) {
+            return;
+        }
+        paused = false;
+        for (auto& job: jobs) {
+            if (job->missed) {
+                job->missed = false;
+                due(*job);
+            }
+        }
+    }
+
+private:
+    void add(size_t i) {
+        if (content.modules[i].exec.empty() || content.modules[i].persist) {
+            return;
+        }
+        auto job = std::make_unique<job_t>();
+        job_t* j = job.get();
+        j->module = i;
+        j->interval = std::make_unique<timerfd_t>(reactor, [this, j]() { due(*j); });
+        j->timeout = std::make_unique<timerfd_t>(reactor, [this, j]() { expire(*j); });
+        by_module[i] = j;
+        jobs.push_back(std::move(job));
+        due(*j);
+    }
+
+    void retire(job_t& job) {
+        job.retired = true;
+        job.pending = false;
+        job.missed = false;
+        job.interval->disarm();
+        if (job.queued) {
+            job.queued = false;
+            waiting.erase(std::find(waiting.begin(), waiting.end(), &job));
+        }
+        if (job.active) {
+            kill(-job.pgid, SIGTERM);
+        }
+    }
+
+    void due(job_t& job) {
+        job.interval->disarm();
+        if (job.queued) {
+            return;
+        }
+        if (paused) {
+            job.missed = true;
+            return;
+        }
+        if (running >= max_jobs) {
+            job.queued = true;
+            waiting.push_back(&job);
+            return;
+        }
+        start(job);
+    }
+
+    void start(job_t& job) {
+        const module_t& module = content.modules[job.module];
+        job.start = clock::now();
+        job.used = 0;
+        job.timed_out = false;
+        job.overflowed = false;
+        job.pid = spawn(module.exec, &job.fd, true);
+        if (job.pid == -1) {
+            job.interval->arm(reactor.align(job.start + module.interval));
+            return;
+        }
+        job.pgid = job.pid;
+        job.active = true;
+        running++;
+        set_nonblocking(job.fd);
+        reactor.add(job.fd, [this, &job](uint32_t) { drain(job); });
+        children.watch(job.pid, [this, &job](int status) { exited(job, status); });
+        job.timeout->arm(job.start + module.timeout);
+    }
+
+    void drain(job_t& job) {
+        while (true) {
+            if (job.used == job.output.size()) {
+                if (job.output.size() >= max_output) {
+                    overflow(job);
+                    break;
+                }
+                job.output.resize(std::min(job.output.size() * 2, max_output));
+            }
+            ssize_t n = read(job.fd, job.output.data() + job.used, job.output.size() - job.used);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (n <= 0) {
+                break;
+            }
+            job.used += n;
+        }
+        reactor.remove(job.fd);
+        close(job.fd);
+        job.fd = -1;
+        finish(job);
+    }
+
+    void exited(job_t& job, int status) {
+        job.pid = -1;
+        job.status = status;
+        finish(job);
+    }
+
+    // kills the whole group, as what holds stdout open may not be the child,
+    // which can already have been reaped
+    void expire(job_t& job) {
+        if (job.active) {
+            if (!job.retired) {
+                std::cout << "timed out: " << content.modules[job.module].exec << std::endl;
+            }
+            job.timed_out = true;
+            kill(-job.pgid, SIGKILL);
+        }
+    }
+
+    // stops reading and kills the group, as expire() does
+    void overflow(job_t& job) {
+        if (!job.retired) {
+            std::cout << "printed more than " << max_output << " bytes: " << content.modules[job.module].exec << std::endl;
+        }
+        job.overflowed = true;
+        kill(-job.pgid, SIGKILL);
+    }
+
+    // a job is done once its stdout is closed and it has been reaped
+    void finish(job_t& job) {
+        if (job.fd != -1 || job.pid != -1) {
+            return;
+        }
+        job.timeout->disarm();
+        job.active = false;
+        running--;
+        if (job.retired) {
+            start_waiting();
+            return;
+        }
+        const module_t& module = content.modules[job.module];
+        record(job, module);
+        if (!job.timed_out && !job.overflowed) {
+            // a format reads fields from the output as printed, lines and all
+            size_t used = module.formatter ? job.used : clean_output(job.output.data(), job.used);
+            std::string_view output(job.output.data(), used);
+            if (content.publish(job.module, output)) {
+                reactor.request_frame();
+            }
+        }
+        if (job.pending) {
+            job.pending = false;
+            due(job);
+        } else {
+            job.interval->arm(reactor.align(job.start + module.interval));
+        }
+        start_waiting();
+    }
+
+    void record(const job_t& job, const module_t& module) {
+        auto now = clock::now();
+        module_stats_t& m = stats.modules[module.exec.line];
+        m.duration.add(now - job.start);
+        if (job.timed_out) {
+            m.timed_out++;
+        } else if (job.overflowed) {
+            m.failed++;
+        } else if (WIFSIGNALED(job.status)) {
+            m.killed++;
+        } else if (WEXITSTATUS(job.status) == 0) {
+            m.succeeded++;
+        } else {
+            m.failed++;
+        }
+        stats.trace.add(module.exec.line.c_str(), job.start, now);
+    }
+
+    void start_waiting() {
+        while (running < max_jobs && !waiting.empty()) {
+            job_t* next = waiting.front();
+            waiting.pop_front();
+            next->queued = false;
+            start(*next);
+        }
+    }
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+// which vectorised version of a loop runs, picked once from what the cpu
+// supports; sse2 is always there on x86_64, and elsewhere only the scalar
+// versions are built
+enum class simd_t {
+    scalar, sse2, avx2,
+};
+
+simd_t best_simd() {
+#if defined(__x86_64__)
+    static const simd_t best = __builtin_cpu_supports("avx2") ? simd_t::avx2 : simd_t::sse2;
+    return best;
+#else
+    return simd_t::scalar;
+#endif
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+// counts values in power-of-two buckets, bucket i holding values below 2^i
+// fixed size, so recording never allocates
+struct histogram_t {
+    std::array<uint64_t, 40> buckets {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void add(uint64_t value) {
+        size_t i = 0;
+        while (i + 1 < buckets.size() && (uint64_t(1) << i) <= value) {
+            i++;
+        }
+        buckets[i]++;
+        count++;
+        sum += value;
+        max = std::max(max, value);
+    }
+    void add(std::chrono::steady_clock::duration d) {
+        add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count()));
+    }
+
+    // the upper bound of the bucket the percentile falls into
+    uint64_t percentile(double p) const {
+        uint64_t rank = static_cast<uint64_t>(p * count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); i++) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return std::min(max, uint64_t(1) << i);
+            }
+        }
+        return max;
+    }
+
+    std::string json() const {
+        char buffer[160];
+        std::snprintf(buffer, sizeof(buffer),
+            "{\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu}",
+            static_cast<unsigned long long>(count),
+            count ? static_cast<double>(sum) / count : 0.0,
+            static_cast<unsigned long long>(percentile(0.5)),
+            static_cast<unsigned long long>(percentile(0.99)),
+            static_cast<unsigned long long>(max)
+        );
+        return buffer;
+    }
+};
+
+// the last `capacity` spans, for chrome://tracing or perfetto
+// a ring of fixed size entries, so recording never allocates either
+struct trace_t {
+    using clock = std::chrono::steady_clock;
+
+    struct event_t {
+        char name[64];
+        clock::time_point begin;
+        clock::time_point end;
+    };
+
+    std::vector<event_t> events;
+    size_t next = 0;
+    size_t count = 0;
+
+    void enable(size_t capacity) {
+        events.assign(capacity, event_t{});
+        next = 0;
+        count = 0;
+    }
+
+    void add(const char* name, clock::time_point begin, clock::time_point end) {
+        if (events.empty()) {
+            return;
+        }
+        event_t& span = events[next];
+        std::strncpy(span.name, name, sizeof(span.name) - 1);
+        span.name[sizeof(span.name) - 1] = 0;
+        span.begin = begin;
+        span.end = end;
+        next = (next + 1) % events.size();
+        count = std::min(count + 1, events.size());
+    }
+
+    // chrome trace event format, complete events with microsecond timestamps
+    std::string json() const {
+        std::string out = "{\"traceEvents\": [";
+        const auto us = [](clock::time_point t) {
+            return std::chrono::duration<double, std::micro>(t.time_since_epoch()).count();
+        };
+        for (size_t i = 0; i < count; i++) {
+            const event_t& span = events[(next + events.size() - count + i) % events.size()];
+            char buffer[128];
+            std::snprintf(buffer, sizeof(buffer), "%s\n{\"ph\": \"X\", \"pid\": %d, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f, \"name\": ",
+                i == 0 ? "" : ",", static_cast<int>(getpid()), us(span.begin), us(span.end) - us(span.begin));
+            out += buffer;
+            out += json_string(span.name);
+            out += "}";
+        }
+        out += "\n]}\n";
+        return out;
+    }
+
+    static std::string json_string(const std::string& s) {
+        std::string out = "\"";
+        for (char c: s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                out += buffer;
+            } else {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+};
+
+struct module_stats_t {
+    histogram_t duration;
+    uint64_t succeeded = 0;
+    uint64_t failed = 0;
+    uint64_t killed = 0;
+    uint64_t timed_out = 0;
+};
+
+// what the reactor thread spends its time on
+// everything runs on that one thread, so the counters need no locking or
+// atomics; other threads (startup) don't record anything
+struct stats_t {
+    // times in microseconds
+    histogram_t handlers;
+    histogram_t idle;
+    histogram_t frame;
+    histogram_t bar_redraw;
+    histogram_t notifications_redraw;
+    // from a key press arriving to its command being started
+    histogram_t keys;
+    // from a key press in the launcher to its matches being updated
+    histogram_t launcher;
+    // from the lock being asked for to the screen being covered
+    histogram_t lock;
+    // setting the wallpaper, with any decoding and scaling it took
+    histogram_t wallpaper;
+    // how many fds were ready per epoll_wait, and X events per drain
+    histogram_t ready;
+    histogram_t x_events;
+    // exec modules by command line, so they survive config reloads
+    std::map<std::string, module_stats_t> modules;
+    // values that are kept elsewhere, e.g. cache counters, read when reported
+    std::vector<std::pair<std::string, std::function<double()>>> gauges;
+    trace_t trace;
+
+    std::string json() const {
+        std::string out = "{\n";
+        const std::pair<const char*, const histogram_t*> histograms[] = {
+            {"handlers_us", &handlers},
+            {"idle_us", &idle},
+            {"frame_us", &frame},
+            {"bar_redraw_us", &bar_redraw},
+            {"notifications_redraw_us", &notifications_redraw},
+            {"keys_us", &keys},
+            {"launcher_us", &launcher},
+            {"lock_us", &lock},
+            {"wallpaper_us", &wallpaper},
+            {"ready_fds", &ready},
+            {"x_events", &x_events},
+        };
+        for (const auto& [name, histogram]: histograms) {
+            out += "  \"" + std::string(name) + "\": " + histogram->json() + ",\n";
+        }
+        for (const auto& [name, gauge]: gauges) {
+            char buffer[64];
+            std::snprintf(buffer, sizeof(buffer), "%g", gauge());
+            out += "  " + trace_t::json_string(name) + ": " + buffer + ",\n";
+        }
+        out += "  \"modules\": {";
+        bool first = true;
+        for (const auto& [line, module]: modules) {
+            char buffer[128];
+            std::snprintf(buffer, sizeof(buffer), ", \"succeeded\": %llu, \"failed\": %llu, \"killed\": %llu, \"timed_out\": %llu}",
+                static_cast<unsigned long long>(module.succeeded),
+                static_cast<unsigned long long>(module.failed),
+                static_cast<unsigned long long>(module.killed),
+                static_cast<unsigned long long>(module.timed_out));
+            out += first ? "\n" : ",\n";
+            out += "    " + trace_t::json_string(line) + ": {\"duration_us\": " + module.duration.json() + buffer;
+            first = false;
+        }
+        out += "\n  }\n}\n";
+        return out;
+    }
+};
+
+stats_t stats;
+
+// records how long a scope took into a histogram, and into the trace when enabled
+struct span_t {
+    const char* name;
+    histogram_t& histogram;
+    std::chrono::steady_clock::time_point begin;
+
+    span_t(const char* _name, histogram_t& _histogram):
+        name(_name),
+        histogram(_histogram),
+        begin(std::chrono::steady_clock::now())
+    {}
+    ~span_t() {
+        auto end = std::chrono::steady_clock::now();
+        histogram.add(end - begin);
+        stats.trace.add(name, begin, end);
+    }
+    span_t(const span_t&) = delete;
+    span_t& operator=(const span_t&) = delete;
+};
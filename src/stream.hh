@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+
+#include "bar.hh"
+#include "process.hh"
+#include "reactor.hh"
+
+// keeps one long-running child per persist = true module and publishes each
+// complete line it prints as the module's content
+// children that exit are restarted with exponential backoff
+struct streams_t {
+    using clock = std::chrono::steady_clock;
+
+    struct stream_t {
+        size_t module;
+        std::unique_ptr<timerfd_t> restart;
+        pid_t pid = -1;
+        int fd = -1;
+        std::string buffer;
+        // the rest of a line too long to keep is being skipped
+        bool discarding = false;
+        clock::time_point started;
+        std::chrono::milliseconds backoff {0};
+        // its module went away in a reload, it is dropped once its child is gone
+        bool retired = false;
+    };
+
+    content_t& content;
+    reactor_t& reactor;
+    children_t& children;
+    std::vector<std::unique_ptr<stream_t>> streams;
+
+    static constexpr std::chrono::milliseconds min_backoff {500};
+    static constexpr std::chrono::milliseconds max_backoff {60000};
+    // a child that stayed up this long starts over from min_backoff
+    static constexpr std::chrono::milliseconds min_uptime {10000};
+    // longer lines are dropped whole, so a child that never prints a
+    // newline can't grow the buffer without end
+    static constexpr size_t max_line = 64 * 1024;
+
+    streams_t(content_t& _content, reactor_t& _reactor, children_t& _children):
+        content(_content),
+        reactor(_reactor),
+        children(_children)
+    {
+        for (size_t i = 0; i < content.modules.size(); i++) {
+            add(i);
+        }
+    }
+
+    // follows content.replace(), moved says where each old module went
+    // children of modules that moved keep running, children of modules that
+    // are gone are stopped, and modules that are new get a child started
+    void reload(const std::vector<size_t>& moved) {
+        streams.erase(std::remove_if(streams.begin(), streams.end(), [](const std::unique_ptr<stream_t>& stream) {
+            return stream->retired && stream->pid == -1 && stream->fd == -1;
+        }), streams.end());
+        std::vector<bool> running(content.modules.size(), false);
+        for (auto& stream: streams) {
+            if (stream->retired) {
+                continue;
+            }
+            size_t i = moved[stream->module];
+            if (i == content_t::npos) {
+                stream->retired = true;
+                stream->restart->disarm();
+                if (stream->pid != -1) {
+                    kill(-stream->pid, SIGTERM);
+                }
+                continue;
+            }
+            stream->module = i;
+            running[i] = true;
+        }
+        for (size_t i = 0; i < content.modules.size(); i++) {
+            if (!running[i]) {
+                add(i);
+            }
+        }
+    }
+
+private:
+    void add(size_t i) {
+        if (!content.modules[i].persist || content.modules[i].exec.empty()) {
+            return;
+        }
+        auto stream = std::make_unique<stream_t>();
+        stream_t* s = stream.get();
+        s->module = i;
+        s->restart = std::make_unique<timerfd_t>(reactor, [this, s]() { start(*s); });
+        streams.push_back(std::move(stream));
+        start(*s);
+    }
+
+    void start(stream_t& stream) {
+        stream.buffer.clear();
+        stream.discarding = false;
+        stream.started = clock::now();
+        stream.pid = spawn(content.modules[stream.module].exec, &stream.fd, true);
+        if (stream.pid == -1) {
+            stream.fd = -1;
+            stopped(stream);
+            return;
+        }
+        set_nonblocking(stream.fd);
+        reactor.add(stream.fd, [this, &stream](uint32_t) {
+            if (!drain(stream)) {
+                reactor.remove(stream.fd);
+                close(stream.fd);
+                stream.fd = -1;
+                // take down anything the child left behind holding the pipe
+                if (stream.pid != -1) {
+                    kill(-stream.pid, SIGTERM);
+                }
+                stopped(stream);
+            }
+        });
+        children.watch(stream.pid, [this, &stream](int) {
+            stream.pid = -1;
+            stopped(stream);
+        });
+    }
+
+    // restarts once the child has both closed its stdout and been reaped
+    void stopped(stream_t& stream) {
+        if (stream.fd != -1 || stream.pid != -1 || stream.retired) {
+            return;
+        }
+        if (clock::now() - stream.started >= min_uptime) {
+            stream.backoff = std::chrono::milliseconds(0);
+        }
+        stream.backoff = std::clamp(stream.backoff * 2, min_backoff, max_backoff);
+        stream.restart->arm(clock::now() + stream.backoff);
+    }
+
+    // after n bytes were appended to the buffer, drops what goes over max_line
+    void limit(stream_t& stream, size_t n) {
+        std::string& buffer = stream.buffer;
+        if (stream.discarding) {
+            size_t newline = buffer.find('\n', buffer.size() - n);
+            if (newline == std::string::npos) {
+                buffer.resize(buffer.size() - n);
+                return;
+            }
+            buffer.erase(buffer.size() - n, newline + 1 - (buffer.size() - n));
+            stream.discarding = false;
+        }
+        if (buffer.size() <= max_line) {
+            return;
+        }
+        size_t end = buffer.rfind('\n');
+        size_t partial = end == std::string::npos ? buffer.size() : buffer.size() - end - 1;
+        if (partial > max_line) {
+            buffer.erase(end == std::string::npos ? 0 : end + 1);
+            stream.discarding = true;
+            return;
+        }
+        // complete lines piling up within one read, only the newest is shown
+        size_t previous = end > 0 ? buffer.rfind('\n', end - 1) : std::string::npos;
+        if (previous != std::string::npos) {
+            buffer.erase(0, previous + 1);
+        }
+    }
+
+    // returns false once the child has closed its stdout
+    bool drain(stream_t& stream) {
+        std::array<char, 4096> chunk;
+        bool open = true;
+        while (true) {
+            ssize_t n = read(stream.fd, chunk.data(), chunk.size());
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                open = false;
+                break;
+            }
+            stream.buffer.append(chunk.data(), n);
+            limit(stream, n);
+        }
+        size_t end = stream.buffer.rfind('\n');
+        if (end == std::string::npos) {
+            return open;
+        }
+        // only the newest complete line matters, older ones would be overdrawn anyway
+        size_t begin = 0;
+        if (end > 0) {
+            size_t previous = stream.buffer.rfind('\n', end - 1);
+            if (previous != std::string::npos) {
+                begin = previous + 1;
+            }
+        }
+        std::string_view line(stream.buffer.data() + begin, end - begin);
+        if (!stream.retired && content.publish(stream.module, line)) {
+            reactor.request_frame();
+        }
+        stream.buffer.erase(0, end + 1);
+        return open;
+    }
+};
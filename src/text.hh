@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <pango/pangocairo.h>
+
+// a shaped and measured piece of text, ready to be shown on any cairo context
+struct layout_t {
+    PangoLayout* layout;
+    double width;
+    double height;
+
+    layout_t(PangoLayout* layout_): layout(layout_) {
+        int w, h;
+        pango_layout_get_pixel_size(layout, &w, &h);
+        width = w;
+        height = h;
+    }
+    ~layout_t() {
+        g_object_unref(layout);
+    }
+    layout_t(const layout_t&) = delete;
+    layout_t& operator=(const layout_t&) = delete;
+
+    void show(cairo_t* c, double x, double y) const {
+        cairo_move_to(c, x, y);
+        pango_cairo_show_layout(c, layout);
+    }
+};
+
+struct font_metrics_t {
+    double ascent;
+    double height;
+};
+
+// shapes text with pango and keeps the most recently used layouts around,
+// so text that hasn't changed is never shaped or measured again
+struct text_cache_t {
+    struct key_t {
+        std::string font;
+        double size;
+        std::string text;
+        bool markup;
+        bool operator==(const key_t& x) const {
+            return size == x.size && markup == x.markup && font == x.font && text == x.text;
+        }
+    };
+    struct key_hash_t {
+        size_t operator()(const key_t& k) const {
+            size_t h = std::hash<std::string>{}(k.text);
+            h ^= std::hash<std::string>{}(k.font) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            h ^= std::hash<double>{}(k.size) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h ^ k.markup;
+        }
+    };
+    using entry_t = std::pair<key_t, std::shared_ptr<const layout_t>>;
+
+    // a font map of its own rather than the thread's default one, so the
+    // cache can be set up on one thread and handed to another
+    PangoFontMap* font_map;
+    PangoContext* context;
+    std::map<std::pair<std::string, double>, PangoFontDescription*> fonts;
+    std::list<entry_t> lru;
+    std::unordered_map<key_t, std::list<entry_t>::iterator, key_hash_t> index;
+    size_t capacity;
+    size_t hits = 0;
+    size_t misses = 0;
+
+    text_cache_t(size_t capacity_ = 256):
+        font_map(pango_cairo_font_map_new()),
+        context(pango_font_map_create_context(font_map)),
+        capacity(capacity_)
+    {}
+    ~text_cache_t() {
+        lru.clear();
+        for (auto& [_, desc]: fonts) {
+            pango_font_description_free(desc);
+        }
+        g_object_unref(context);
+        g_object_unref(font_map);
+    }
+    text_cache_t(const text_cache_t&) = delete;
+    text_cache_t& operator=(const text_cache_t&) = delete;
+
+    // size is in pixels
+    PangoFontDescription* font(const std::string& family, double size) {
+        auto& desc = fonts[{family, size}];
+        if (!desc) {
+            desc = pango_font_description_new();
+            pango_font_description_set_family(desc, family.c_str());
+            pango_font_description_set_absolute_size(desc, size * PANGO_SCALE);
+        }
+        return desc;
+    }
+
+    font_metrics_t metrics(const std::string& family, double size) {
+        PangoFontMetrics* metrics = pango_context_get_metrics(context, font(family, size), nullptr);
+        font_metrics_t result {
+            static_cast<double>(pango_font_metrics_get_ascent(metrics)) / PANGO_SCALE,
+            static_cast<double>(pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent(metrics)) / PANGO_SCALE,
+        };
+        pango_font_metrics_unref(metrics);
+        return result;
+    }
+
+    std::shared_ptr<const layout_t> get(const std::string& family, double size, const std::string& text, bool markup = false) {
+        key_t key {family, size, text, markup};
+        auto it = index.find(key);
+        if (it != index.end()) {
+            hits++;
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->second;
+        }
+        misses++;
+        PangoLayout* layout = pango_layout_new(context);
+        pango_layout_set_font_description(layout, font(family, size));
+        if (markup) {
+            pango_layout_set_markup(layout, text.c_str(), text.length());
+        } else {
+            pango_layout_set_text(layout, text.c_str(), text.length());
+        }
+        lru.emplace_front(key, std::make_shared<const layout_t>(layout));
+        index.emplace(std::move(key), lru.begin());
+        while (lru.size() > capacity) {
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+        return lru.front().second;
+    }
+};
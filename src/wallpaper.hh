@@ -0,0 +1,431 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cairo/cairo.h>
+#include <cairo/cairo-xcb.h>
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+
+#include "atoms.hh"
+#include "reactor.hh"
+#include "render.hh"
+#include "resample.hh"
+#include "simd.hh"
+#include "stats.hh"
+
+// one output's worth of scaled wallpaper as a file:
+//     header, 64 bytes, so the pixels after it stay aligned
+//     width × height xrgb pixels, as the server takes them
+struct wallpaper_header_t {
+    char magic[8];
+    // of the image it was scaled from
+    uint64_t mtime;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+    uint8_t padding[32];
+
+    static constexpr char expected[8] = {'a', 'd', 'e', 'w', 'a', 'l', 'l', '1'};
+};
+static_assert(sizeof(wallpaper_header_t) == 64);
+
+// $XDG_CACHE_HOME/ade/wallpaper-<hash of the image's path>-<width>x<height>
+// the image's mtime and size are checked against the header, so a changed
+// image replaces its cached files instead of piling up new ones
+std::string wallpaper_cache_path(const std::string& image, size_t width, size_t height) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char c: image) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+    const char* cache = std::getenv("XDG_CACHE_HOME");
+    const char* home = std::getenv("HOME");
+    std::string dir = cache && *cache ? cache : std::string(home && *home ? home : "/tmp") + "/.cache";
+    char name[64];
+    std::snprintf(name, sizeof(name), "wallpaper-%016llx-%zux%zu", static_cast<unsigned long long>(hash), width, height);
+    return dir + "/ade/" + name;
+}
+
+// returns the cached file open, or -1 if it is missing or was made from
+// something else
+int open_wallpaper_cache(const std::string& path, const wallpaper_header_t& want) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    wallpaper_header_t header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) != 0 ||
+        std::memcmp(header.magic, want.magic, sizeof(header.magic)) != 0 ||
+        header.mtime != want.mtime || header.size != want.size ||
+        header.width != want.width || header.height != want.height ||
+        static_cast<uint64_t>(st.st_size) != sizeof(header) + uint64_t(header.width) * header.height * sizeof(uint32_t)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// written next to the cache and renamed over it, like the app index
+bool write_wallpaper_cache(const std::string& path, const wallpaper_header_t& header, const std::vector<uint32_t>& pixels) {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size() * sizeof(uint32_t));
+    file.close();
+    if (!file || std::rename(temporary.c_str(), path.c_str()) == -1) {
+        std::cout << "writing " << path << " failed!" << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// scales an image to cover width × height, cutting off what sticks out
+// evenly on both sides
+std::vector<uint32_t> scale_to_fill(const uint32_t* src, size_t src_width, size_t src_height, size_t src_stride,
+    size_t width, size_t height, simd_t simd = best_simd(), size_t threads = std::thread::hardware_concurrency()) {
+    std::vector<uint32_t> pixels(width * height);
+    double scale = std::max(static_cast<double>(width) / src_width, static_cast<double>(height) / src_height);
+    double cut_width = width / scale;
+    double cut_height = height / scale;
+    resample(src, src_width, src_height, src_stride, (src_width - cut_width) / 2, (src_height - cut_height) / 2,
+        cut_width, cut_height, pixels.data(), width, height, simd, threads);
+    return pixels;
+}
+
+// the root window's background: a png scaled to fill each output and
+// published in _XROOTPMAP_ID and ESETROOT_PMAP_ID, for compositors and
+// terminals that fake transparency
+// each output's pixels are cached on disk, so logging in again or plugging
+// in a monitor of a size seen before hands the cached file to the server
+// through MIT-SHM, which maps it, with nothing decoded or scaled; only on a
+// miss is the image decoded, once for every output that missed
+// the caches are checked, and made on a miss, on a thread of their own, like
+// the app index, and only uploading them and publishing the pixmap is left
+// for the reactor's thread
+// the pixmap is drawn on a connection of its own, which is closed with its
+// resources kept, as Esetroot does, so it outlives us and so whoever sets
+// the next wallpaper can free it by killing that connection, not ours
+struct wallpaper_t {
+    // what the worker hands over: a connection to draw on, and for each
+    // output its cached file open, or -1 if there is none
+    struct prepared_t {
+        xcb_connection_t* connection = nullptr;
+        bool fd_passing = false;
+        // the screen first, then the outputs
+        std::vector<aabb_t> areas;
+        std::vector<int> fds;
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
+    screen_t& screen;
+    reactor_t& reactor;
+    std::string image;
+    // the screen and outputs the pixmap being drawn or published is for
+    std::vector<aabb_t> drawn;
+    simd_t simd = best_simd();
+    size_t threads = std::thread::hardware_concurrency();
+    size_t hits = 0;
+    size_t misses = 0;
+    std::thread worker;
+    int ready = -1;
+    // only touched by the worker until it is joined
+    prepared_t prepared;
+    // the image or the outputs changed again while the worker was busy
+    bool again = false;
+
+    wallpaper_t(screen_t& _screen, reactor_t& _reactor):
+        screen(_screen),
+        reactor(_reactor)
+    {
+        ready = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        reactor.add(ready, [this](uint32_t) { finished(); });
+    }
+    ~wallpaper_t() {
+        if (worker.joinable()) {
+            worker.join();
+        }
+        discard(prepared);
+        reactor.remove(ready);
+        close(ready);
+    }
+    wallpaper_t(const wallpaper_t&) = delete;
+    wallpaper_t& operator=(const wallpaper_t&) = delete;
+
+    // an empty path leaves the root as it is
+    void set(const std::string& path) {
+        image = path;
+        drawn.clear();
+        update();
+    }
+
+    // after the outputs changed; does nothing if their areas didn't
+    void update() {
+        std::vector<aabb_t> areas = {screen.aabb};
+        for (const output_t& output: screen.outputs) {
+            areas.push_back(output.aabb);
+        }
+        if (image.empty() || areas == drawn) {
+            return;
+        }
+        drawn = areas;
+        if (worker.joinable()) {
+            again = true;
+            return;
+        }
+        start();
+    }
+
+    // until the last set() or update() has been published
+    bool busy() const {
+        return worker.joinable();
+    }
+
+private:
+    // the worker gets copies of everything it reads
+    void start() {
+        uint8_t depth = screen.screen->root_depth;
+        if (depth != 24 && depth != 32) {
+            std::cout << "wallpaper on a root of depth " << int(depth) << " failed!" << std::endl;
+            return;
+        }
+        worker = std::thread([this, path = image, areas = drawn, simd = simd, threads = threads]() {
+            prepared = prepare(path, areas, simd, threads);
+            uint64_t one = 1;
+            (void) !write(ready, &one, sizeof(one));
+        });
+    }
+
+    void finished() {
+        uint64_t count;
+        while (read(ready, &count, sizeof(count)) > 0) {}
+        if (!worker.joinable()) {
+            return;
+        }
+        worker.join();
+        prepared_t next = std::move(prepared);
+        prepared = {};
+        hits += next.hits;
+        misses += next.misses;
+        // what it prepared is for an image or outputs that are gone by now
+        if (again) {
+            again = false;
+            discard(next);
+            start();
+            return;
+        }
+        // or the wallpaper was unset in the meantime
+        if (image.empty()) {
+            discard(next);
+            return;
+        }
+        draw(next);
+    }
+
+    static void discard(prepared_t& next) {
+        for (int fd: next.fds) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        next.fds.clear();
+        if (next.connection) {
+            xcb_disconnect(next.connection);
+            next.connection = nullptr;
+        }
+    }
+
+    // everything that may block: connecting, and reading, decoding, scaling
+    // and writing the image for every output whose cache missed
+    static prepared_t prepare(const std::string& image, const std::vector<aabb_t>& areas, simd_t simd, size_t threads) {
+        prepared_t next;
+        next.areas = areas;
+        struct stat st;
+        if (stat(image.c_str(), &st) != 0) {
+            std::cout << "reading " << image << " failed!" << std::endl;
+            return next;
+        }
+        // to $DISPLAY, like connection_t, so to the same root
+        next.connection = xcb_connect(nullptr, nullptr);
+        if (xcb_connection_has_error(next.connection)) {
+            std::cout << "connecting for the wallpaper failed!" << std::endl;
+            xcb_disconnect(next.connection);
+            next.connection = nullptr;
+            return next;
+        }
+        next.fd_passing = can_pass_fds(next.connection);
+        cairo_surface_t* decoded = nullptr;
+        bool undecodable = false;
+        for (size_t i = 1; i < areas.size(); i++) {
+            aabb_t area = areas[i];
+            wallpaper_header_t header {};
+            std::memcpy(header.magic, wallpaper_header_t::expected, sizeof(header.magic));
+            header.mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            header.size = st.st_size;
+            header.width = area.width();
+            header.height = area.height();
+            std::string path = wallpaper_cache_path(image, header.width, header.height);
+            int fd = open_wallpaper_cache(path, header);
+            if (fd != -1) {
+                next.hits++;
+            } else {
+                next.misses++;
+                if (!decoded && !undecodable) {
+                    decoded = decode(image);
+                    undecodable = !decoded;
+                }
+                if (decoded) {
+                    cairo_surface_flush(decoded);
+                    const uint32_t* pixels = reinterpret_cast<const uint32_t*>(cairo_image_surface_get_data(decoded));
+                    write_wallpaper_cache(path, header, scale_to_fill(pixels,
+                        cairo_image_surface_get_width(decoded), cairo_image_surface_get_height(decoded),
+                        cairo_image_surface_get_stride(decoded) / sizeof(uint32_t), header.width, header.height, simd, threads));
+                    fd = open_wallpaper_cache(path, header);
+                }
+            }
+            next.fds.push_back(fd);
+        }
+        if (decoded) {
+            cairo_surface_destroy(decoded);
+        }
+        return next;
+    }
+
+    // as xrgb, which is what cairo gives for pngs with or without alpha;
+    // alpha comes premultiplied, so transparent parts end up black
+    static cairo_surface_t* decode(const std::string& image) {
+        cairo_surface_t* decoded = cairo_image_surface_create_from_png(image.c_str());
+        cairo_format_t format = cairo_image_surface_get_format(decoded);
+        if (cairo_surface_status(decoded) != CAIRO_STATUS_SUCCESS || (format != CAIRO_FORMAT_RGB24 && format != CAIRO_FORMAT_ARGB32)) {
+            std::cout << "decoding " << image << " failed!" << std::endl;
+            cairo_surface_destroy(decoded);
+            return nullptr;
+        }
+        return decoded;
+    }
+
+    // MIT-SHM 1.2 lets the server map a file we pass it
+    static bool can_pass_fds(xcb_connection_t* c) {
+        const xcb_query_extension_reply_t* extension = xcb_get_extension_data(c, &xcb_shm_id);
+        if (!extension || !extension->present) {
+            return false;
+        }
+        xcb_shm_query_version_reply_t* version = xcb_shm_query_version_reply(c, xcb_shm_query_version(c), nullptr);
+        bool ok = version && (version->major_version > 1 || (version->major_version == 1 && version->minor_version >= 2));
+        free(version);
+        return ok;
+    }
+
+    // uploads what the worker prepared into a new pixmap, publishes it and
+    // closes the connection, leaving the pixmap behind
+    void draw(prepared_t& next) {
+        if (!next.connection) {
+            return;
+        }
+        span_t span("wallpaper", stats.wallpaper);
+        xcb_connection_t* c = next.connection;
+        aabb_t root = next.areas[0];
+        uint8_t depth = screen.screen->root_depth;
+        xcb_pixmap_t pixmap = xcb_generate_id(c);
+        xcb_create_pixmap(c, depth, pixmap, screen.screen->root, root.width(), root.height());
+        xcb_gcontext_t gc = xcb_generate_id(c);
+        uint32_t values[] = {screen.screen->black_pixel, 0};
+        xcb_create_gc(c, gc, pixmap, XCB_GC_FOREGROUND | XCB_GC_GRAPHICS_EXPOSURES, values);
+        // whatever no output shows
+        xcb_rectangle_t all {0, 0, static_cast<uint16_t>(root.width()), static_cast<uint16_t>(root.height())};
+        xcb_poly_fill_rectangle(c, pixmap, gc, 1, &all);
+        for (size_t i = 0; i < next.fds.size(); i++) {
+            if (next.fds[i] != -1) {
+                upload(c, next.fds[i], next.fd_passing, pixmap, gc, depth, root, next.areas[i + 1]);
+            }
+        }
+        next.fds.clear();
+        xcb_free_gc(c, gc);
+        publish(c, pixmap);
+        xcb_set_close_down_mode(c, XCB_CLOSE_DOWN_RETAIN_PERMANENT);
+        // a round trip, so the server has it all before the connection goes
+        free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), nullptr));
+        discard(next);
+    }
+
+    // copies a cached file into the pixmap of root at area, and closes it
+    void upload(xcb_connection_t* c, int fd, bool fd_passing, xcb_pixmap_t target, xcb_gcontext_t gc, uint8_t depth, aabb_t root, aabb_t area) {
+        uint16_t width = area.width();
+        uint16_t height = area.height();
+        if (fd_passing) {
+            // xcb closes fd once it is sent
+            xcb_shm_seg_t segment = xcb_generate_id(c);
+            xcb_shm_attach_fd(c, segment, fd, true);
+            xcb_shm_put_image(c, target, gc, width, height, 0, 0, width, height,
+                area.x0 - root.x0, area.y0 - root.y0, depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 0, segment, sizeof(wallpaper_header_t));
+            xcb_shm_detach(c, segment);
+            return;
+        }
+        // otherwise cairo splits it into requests the server takes
+        size_t size = sizeof(wallpaper_header_t) + size_t(width) * height * sizeof(uint32_t);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return;
+        }
+        unsigned char* pixels = static_cast<unsigned char*>(mapped) + sizeof(wallpaper_header_t);
+        cairo_surface_t* image_surface = cairo_image_surface_create_for_data(pixels, CAIRO_FORMAT_RGB24, width, height, width * sizeof(uint32_t));
+        cairo_surface_t* surface = cairo_xcb_surface_create(c, target, screen.visual_type, root.width(), root.height());
+        cairo_device_t* device = cairo_device_reference(cairo_surface_get_device(surface));
+        cairo_t* cr = cairo_create(surface);
+        cairo_set_source_surface(cr, image_surface, area.x0 - root.x0, area.y0 - root.y0);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        cairo_surface_flush(surface);
+        cairo_surface_destroy(surface);
+        // cairo keeps c otherwise, and it is closed once the pixmap is published
+        cairo_device_finish(device);
+        cairo_device_destroy(device);
+        cairo_surface_destroy(image_surface);
+        munmap(mapped, size);
+    }
+
+    // makes target the root's background and tells everyone; the pixmap
+    // whoever set the last one left behind, ourselves included, is freed by
+    // killing what holds it, as Esetroot and feh do
+    void publish(xcb_connection_t* c, xcb_pixmap_t target) {
+        const xcb_window_t root = screen.screen->root;
+        xcb_get_property_cookie_t xroot = xcb_get_property(c, false, root, _XROOTPMAP_ID, XCB_ATOM_PIXMAP, 0, 1);
+        xcb_get_property_cookie_t esetroot = xcb_get_property(c, false, root, ESETROOT_PMAP_ID, XCB_ATOM_PIXMAP, 0, 1);
+        xcb_get_property_reply_t* xroot_reply = xcb_get_property_reply(c, xroot, nullptr);
+        xcb_get_property_reply_t* esetroot_reply = xcb_get_property_reply(c, esetroot, nullptr);
+        if (xroot_reply && esetroot_reply &&
+            xcb_get_property_value_length(xroot_reply) == 4 && xcb_get_property_value_length(esetroot_reply) == 4) {
+            xcb_pixmap_t old = *static_cast<xcb_pixmap_t*>(xcb_get_property_value(xroot_reply));
+            if (old == *static_cast<xcb_pixmap_t*>(xcb_get_property_value(esetroot_reply))) {
+                xcb_kill_client(c, old);
+            }
+        }
+        free(xroot_reply);
+        free(esetroot_reply);
+        xcb_change_window_attributes(c, root, XCB_CW_BACK_PIXMAP, &target);
+        xcb_clear_area(c, false, root, 0, 0, 0, 0);
+        xcb_change_property(c, XCB_PROP_MODE_REPLACE, root, _XROOTPMAP_ID, XCB_ATOM_PIXMAP, 32, 1, &target);
+        xcb_change_property(c, XCB_PROP_MODE_REPLACE, root, ESETROOT_PMAP_ID, XCB_ATOM_PIXMAP, 32, 1, &target);
+    }
+};
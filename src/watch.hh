@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "reactor.hh"
+
+// calls back once a file has changed and settled
+// watches the directory rather than the file, because editors usually save
+// by writing a new file and renaming it over the old one
+// events closer together than `settle` are merged into one callback
+struct file_watch_t {
+    using clock = std::chrono::steady_clock;
+
+    reactor_t& reactor;
+    std::string name;
+    std::function<void()> callback;
+    std::chrono::milliseconds settle {100};
+    timerfd_t timer;
+    int fd;
+
+    file_watch_t(reactor_t& _reactor, const std::string& path, std::function<void()> _callback):
+        reactor(_reactor),
+        callback(std::move(_callback)),
+        timer(reactor, [this]() { callback(); })
+    {
+        std::filesystem::path file = std::filesystem::absolute(path);
+        name = file.filename();
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1 || inotify_add_watch(fd, file.parent_path().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+            std::cout << "inotify_add_watch() failed!" << std::endl;
+            return;
+        }
+        reactor.add(fd, [this](uint32_t) { drain(); });
+    }
+    ~file_watch_t() {
+        if (fd != -1) {
+            reactor.remove(fd);
+            close(fd);
+        }
+    }
+    file_watch_t(const file_watch_t&) = delete;
+    file_watch_t& operator=(const file_watch_t&) = delete;
+
+private:
+    void drain() {
+        alignas(inotify_event) std::array<char, 4096> buffer;
+        ssize_t n;
+        bool changed = false;
+        while ((n = read(fd, buffer.data(), buffer.size())) > 0) {
+            for (ssize_t i = 0; i < n;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer.data() + i);
+                if (event->len > 0 && name == event->name) {
+                    changed = true;
+                }
+                i += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (changed) {
+            timer.arm(clock::now() + settle);
+        }
+    }
+};
+
+// calls back once anything in any of a set of directories was added,
+// removed, renamed or rewritten, and has settled; directories that don't
+// exist are skipped
+struct dir_watch_t {
+    using clock = std::chrono::steady_clock;
+
+    reactor_t& reactor;
+    std::function<void()> callback;
+    std::chrono::milliseconds settle {500};
+    timerfd_t timer;
+    int fd;
+
+    dir_watch_t(reactor_t& _reactor, const std::vector<std::string>& dirs, std::function<void()> _callback):
+        reactor(_reactor),
+        callback(std::move(_callback)),
+        timer(reactor, [this]() { callback(); })
+    {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1) {
+            std::cout << "inotify_init1() failed!" << std::endl;
+            return;
+        }
+        for (const auto& dir: dirs) {
+            inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR);
+        }
+        reactor.add(fd, [this](uint32_t) { drain(); });
+    }
+    ~dir_watch_t() {
+        if (fd != -1) {
+            reactor.remove(fd);
+            close(fd);
+        }
+    }
+    dir_watch_t(const dir_watch_t&) = delete;
+    dir_watch_t& operator=(const dir_watch_t&) = delete;
+
+private:
+    void drain() {
+        alignas(inotify_event) std::array<char, 4096> buffer;
+        bool changed = false;
+        while (read(fd, buffer.data(), buffer.size()) > 0) {
+            changed = true;
+        }
+        if (changed) {
+            timer.arm(clock::now() + settle);
+        }
+    }
+};
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <xcb/xcb.h>
+#include <xcb/xcb_ewmh.h>
+#include <xcb/xcb_icccm.h>
+
+#include "area.hh"
+#include "render.hh"
+
+// a cell of the layout: either a window, or two cells splitting it along
+// its longer side, so a workspace is a tree of aabb_t chopped in halves
+struct cell_t {
+    aabb_t aabb;
+    cell_t* parent = nullptr;
+    std::unique_ptr<cell_t> first;
+    std::unique_ptr<cell_t> second;
+    xcb_window_t window = XCB_NONE;
+    // what the window was last configured to
+    aabb_t configured;
+
+    bool leaf() const {
+        return !first;
+    }
+};
+
+// the tiling area of one output, kept by the output's name
+struct workspace_t {
+    aabb_t area;
+    std::unique_ptr<cell_t> root;
+};
+
+// tiles every normal top-level window, as the client holding substructure
+// redirect on the root
+// a new window splits the largest cell in two and a closed one gives its
+// half back to its sibling, so only the cells under the split or merged one
+// are laid out again, and only windows whose geometry changed are sent a
+// configure; map requests and configures are collected while a burst of
+// events is handled and only sent by flush()
+struct wm_t {
+    connection_t& connection;
+    screen_t& screen;
+    bool managing = false;
+    std::map<std::string, workspace_t> workspaces;
+    std::unordered_map<xcb_window_t, cell_t*> cells;
+    // windows that asked to be mapped, and windows whose cell changed,
+    // since the last flush()
+    std::vector<xcb_window_t> requested;
+    std::unordered_set<xcb_window_t> dirty;
+
+    wm_t(connection_t& _connection, screen_t& _screen, const std::map<std::string, aabb_t>& areas):
+        connection(_connection),
+        screen(_screen)
+    {
+        const auto& c = connection.connection;
+        for (const auto& [name, area]: areas) {
+            workspaces.emplace(name, workspace_t{area, nullptr});
+        }
+        uint32_t events = XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+        xcb_generic_error_t* error = xcb_request_check(c, xcb_change_window_attributes_checked(c, screen.screen->root, XCB_CW_EVENT_MASK, &events));
+        if (error) {
+            free(error);
+            std::cout << "another window manager is running, not managing windows" << std::endl;
+            return;
+        }
+        managing = true;
+        adopt();
+    }
+    wm_t(const wm_t&) = delete;
+    wm_t& operator=(const wm_t&) = delete;
+
+    // returns true if the event was about a window the wm looks after
+    bool handle_event(xcb_generic_event_t* event) {
+        if (!managing) {
+            return false;
+        }
+        switch (event->response_type & ~0x80) {
+            case XCB_MAP_REQUEST:
+                requested.push_back(reinterpret_cast<xcb_map_request_event_t*>(event)->window);
+                return true;
+            case XCB_UNMAP_NOTIFY:
+                return remove(reinterpret_cast<xcb_unmap_notify_event_t*>(event)->window);
+            case XCB_DESTROY_NOTIFY:
+                {
+                    xcb_window_t window = reinterpret_cast<xcb_destroy_notify_event_t*>(event)->window;
+                    requested.erase(std::remove(requested.begin(), requested.end(), window), requested.end());
+                    return remove(window);
+                }
+            case XCB_CONFIGURE_REQUEST:
+                configure_request(*reinterpret_cast<xcb_configure_request_event_t*>(event));
+                return true;
+            case XCB_ENTER_NOTIFY:
+                {
+                    xcb_enter_notify_event_t& enter = *reinterpret_cast<xcb_enter_notify_event_t*>(event);
+                    if (cells.count(enter.event) && enter.mode == XCB_NOTIFY_MODE_NORMAL) {
+                        xcb_set_input_focus(connection.connection, XCB_INPUT_FOCUS_POINTER_ROOT, enter.event, enter.time);
+                        return true;
+                    }
+                }
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // manages the windows that asked to be mapped, then configures every
+    // window whose cell changed
+    void flush() {
+        if (!requested.empty()) {
+            std::vector<xcb_window_t> windows = std::move(requested);
+            requested.clear();
+            std::vector<bool> tiled = classify(windows);
+            for (size_t i = 0; i < windows.size(); i++) {
+                if (tiled[i] && !cells.count(windows[i])) {
+                    insert(windows[i]);
+                }
+            }
+            // after the configures below, so windows come up at their size
+            configure();
+            for (size_t i = 0; i < windows.size(); i++) {
+                xcb_map_window(connection.connection, windows[i]);
+                if (tiled[i]) {
+                    xcb_set_input_focus(connection.connection, XCB_INPUT_FOCUS_POINTER_ROOT, windows[i], XCB_CURRENT_TIME);
+                }
+            }
+            return;
+        }
+        configure();
+    }
+
+    // after outputs came, went or moved, by output name; windows stay on
+    // their output, and only those of outputs that are gone are placed
+    // again on the remaining ones
+    void set_areas(const std::map<std::string, aabb_t>& areas) {
+        std::vector<xcb_window_t> orphans;
+        for (auto it = workspaces.begin(); it != workspaces.end();) {
+            if (areas.count(it->first)) {
+                ++it;
+                continue;
+            }
+            collect(it->second.root.get(), orphans);
+            it = workspaces.erase(it);
+        }
+        for (const auto& [name, area]: areas) {
+            auto it = workspaces.find(name);
+            if (it == workspaces.end()) {
+                workspaces.emplace(name, workspace_t{area, nullptr});
+                continue;
+            }
+            workspace_t& workspace = it->second;
+            if (workspace.area != area) {
+                workspace.area = area;
+                if (workspace.root) {
+                    layout(workspace.root.get(), area);
+                }
+            }
+        }
+        for (xcb_window_t window: orphans) {
+            cells.erase(window);
+        }
+        for (xcb_window_t window: orphans) {
+            insert(window);
+        }
+    }
+
+private:
+    // takes over the windows that were already mapped before ade started
+    void adopt() {
+        const auto& c = connection.connection;
+        xcb_query_tree_reply_t* tree = xcb_query_tree_reply(c, xcb_query_tree(c, screen.screen->root), nullptr);
+        if (!tree) {
+            return;
+        }
+        xcb_window_t* children = xcb_query_tree_children(tree);
+        std::vector<xcb_get_window_attributes_cookie_t> cookies(xcb_query_tree_children_length(tree));
+        for (size_t i = 0; i < cookies.size(); i++) {
+            cookies[i] = xcb_get_window_attributes(c, children[i]);
+        }
+        std::vector<xcb_window_t> windows;
+        for (size_t i = 0; i < cookies.size(); i++) {
+            xcb_get_window_attributes_reply_t* attributes = xcb_get_window_attributes_reply(c, cookies[i], nullptr);
+            if (attributes && !attributes->override_redirect && attributes->map_state == XCB_MAP_STATE_VIEWABLE) {
+                windows.push_back(children[i]);
+            }
+            free(attributes);
+        }
+        free(tree);
+        std::vector<bool> tiled = classify(windows);
+        for (size_t i = 0; i < windows.size(); i++) {
+            if (tiled[i]) {
+                insert(windows[i]);
+            }
+        }
+        configure();
+    }
+
+    // docks, dialogs, menus and the like, and windows transient for another
+    // one, are left where they asked to be
+    // all the properties are asked for at once, so this is one round trip
+    std::vector<bool> classify(const std::vector<xcb_window_t>& windows) {
+        const auto& c = connection.connection;
+        xcb_ewmh_connection_t& ewmh = connection.ewmh;
+        std::vector<xcb_get_property_cookie_t> types(windows.size());
+        std::vector<xcb_get_property_cookie_t> transients(windows.size());
+        for (size_t i = 0; i < windows.size(); i++) {
+            types[i] = xcb_ewmh_get_wm_window_type(&ewmh, windows[i]);
+            transients[i] = xcb_icccm_get_wm_transient_for(c, windows[i]);
+        }
+        const xcb_atom_t floating[] = {
+            ewmh._NET_WM_WINDOW_TYPE_DOCK,
+            ewmh._NET_WM_WINDOW_TYPE_DESKTOP,
+            ewmh._NET_WM_WINDOW_TYPE_DIALOG,
+            ewmh._NET_WM_WINDOW_TYPE_SPLASH,
+            ewmh._NET_WM_WINDOW_TYPE_UTILITY,
+            ewmh._NET_WM_WINDOW_TYPE_TOOLBAR,
+            ewmh._NET_WM_WINDOW_TYPE_MENU,
+            ewmh._NET_WM_WINDOW_TYPE_DROPDOWN_MENU,
+            ewmh._NET_WM_WINDOW_TYPE_POPUP_MENU,
+            ewmh._NET_WM_WINDOW_TYPE_TOOLTIP,
+            ewmh._NET_WM_WINDOW_TYPE_NOTIFICATION,
+        };
+        std::vector<bool> tiled(windows.size(), true);
+        for (size_t i = 0; i < windows.size(); i++) {
+            xcb_ewmh_get_atoms_reply_t type;
+            if (xcb_ewmh_get_wm_window_type_reply(&ewmh, types[i], &type, nullptr)) {
+                for (uint32_t j = 0; j < type.atoms_len; j++) {
+                    if (std::find(std::begin(floating), std::end(floating), type.atoms[j]) != std::end(floating)) {
+                        tiled[i] = false;
+                    }
+                }
+                xcb_ewmh_get_atoms_reply_wipe(&type);
+            }
+            xcb_window_t parent = XCB_NONE;
+            if (xcb_icccm_get_wm_transient_for_reply(c, transients[i], &parent, nullptr) && parent != XCB_NONE) {
+                tiled[i] = false;
+            }
+        }
+        return tiled;
+    }
+
+    static double area_of(const aabb_t& aabb) {
+        return static_cast<double>(aabb.x1 - aabb.x0) * (aabb.y1 - aabb.y0);
+    }
+
+    static cell_t* largest(cell_t* cell) {
+        if (cell->leaf()) {
+            return cell;
+        }
+        cell_t* a = largest(cell->first.get());
+        cell_t* b = largest(cell->second.get());
+        return area_of(b->aabb) > area_of(a->aabb) ? b : a;
+    }
+
+    // into an empty workspace if there is one, otherwise by splitting the
+    // largest cell of any workspace, which keeps the layout close to a grid
+    void insert(xcb_window_t window) {
+        if (workspaces.empty()) {
+            return;
+        }
+        workspace_t* empty = nullptr;
+        cell_t* split = nullptr;
+        for (auto& [name, workspace]: workspaces) {
+            if (!workspace.root) {
+                if (!empty || area_of(workspace.area) > area_of(empty->area)) {
+                    empty = &workspace;
+                }
+                continue;
+            }
+            cell_t* candidate = largest(workspace.root.get());
+            if (!split || area_of(candidate->aabb) > area_of(split->aabb)) {
+                split = candidate;
+            }
+        }
+        uint32_t events = XCB_EVENT_MASK_ENTER_WINDOW;
+        xcb_change_window_attributes(connection.connection, window, XCB_CW_EVENT_MASK, &events);
+        if (empty) {
+            empty->root = std::make_unique<cell_t>();
+            empty->root->window = window;
+            cells[window] = empty->root.get();
+            layout(empty->root.get(), empty->area);
+            return;
+        }
+        auto kept = std::make_unique<cell_t>();
+        kept->window = split->window;
+        kept->configured = split->configured;
+        kept->parent = split;
+        auto added = std::make_unique<cell_t>();
+        added->window = window;
+        added->parent = split;
+        cells[kept->window] = kept.get();
+        cells[window] = added.get();
+        split->window = XCB_NONE;
+        split->first = std::move(kept);
+        split->second = std::move(added);
+        layout(split, split->aabb);
+    }
+
+    // the sibling of the window's cell takes over their parent's cell
+    bool remove(xcb_window_t window) {
+        auto it = cells.find(window);
+        if (it == cells.end()) {
+            return false;
+        }
+        cell_t* cell = it->second;
+        cells.erase(it);
+        dirty.erase(window);
+        cell_t* parent = cell->parent;
+        if (!parent) {
+            for (auto& [name, workspace]: workspaces) {
+                if (workspace.root.get() == cell) {
+                    workspace.root.reset();
+                }
+            }
+            return true;
+        }
+        bool first = parent->first.get() == cell;
+        std::unique_ptr<cell_t> removed = std::move(first ? parent->first : parent->second);
+        std::unique_ptr<cell_t> sibling = std::move(first ? parent->second : parent->first);
+        parent->window = sibling->window;
+        parent->configured = sibling->configured;
+        parent->first = std::move(sibling->first);
+        parent->second = std::move(sibling->second);
+        if (parent->leaf()) {
+            cells[parent->window] = parent;
+        } else {
+            parent->first->parent = parent;
+            parent->second->parent = parent;
+        }
+        layout(parent, parent->aabb);
+        return true;
+    }
+
+    // lays out a subtree, marking the windows whose cell moved or resized
+    void layout(cell_t* cell, aabb_t aabb) {
+        cell->aabb = aabb;
+        if (cell->leaf()) {
+            if (cell->aabb != cell->configured) {
+                dirty.insert(cell->window);
+            }
+            return;
+        }
+        aabb_t rest = aabb;
+        aabb_t half = aabb.width() >= aabb.height() ?
+            rest.chop(aabb_t::direction::left, aabb.width() / 2) :
+            rest.chop(aabb_t::direction::top, aabb.height() / 2);
+        layout(cell->first.get(), half);
+        layout(cell->second.get(), rest);
+    }
+
+    void configure() {
+        for (xcb_window_t window: dirty) {
+            auto it = cells.find(window);
+            if (it == cells.end()) {
+                continue;
+            }
+            cell_t& cell = *it->second;
+            if (cell.aabb == cell.configured) {
+                continue;
+            }
+            cell.configured = cell.aabb;
+            uint16_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT | XCB_CONFIG_WINDOW_BORDER_WIDTH;
+            uint32_t values[] = {
+                static_cast<uint32_t>(cell.aabb.xpos()), static_cast<uint32_t>(cell.aabb.ypos()),
+                static_cast<uint32_t>(std::max(1, cell.aabb.width())), static_cast<uint32_t>(std::max(1, cell.aabb.height())),
+                0,
+            };
+            xcb_configure_window(connection.connection, window, mask, values);
+        }
+        dirty.clear();
+    }
+
+    // tiled windows get what they already have, as a synthetic configure
+    // notify, everything else gets what it asked for
+    void configure_request(const xcb_configure_request_event_t& request) {
+        const auto& c = connection.connection;
+        auto it = cells.find(request.window);
+        if (it != cells.end()) {
+            aabb_t aabb = it->second->configured;
+            xcb_configure_notify_event_t notify {};
+            notify.response_type = XCB_CONFIGURE_NOTIFY;
+            notify.event = request.window;
+            notify.window = request.window;
+            notify.x = aabb.xpos();
+            notify.y = aabb.ypos();
+            notify.width = aabb.width();
+            notify.height = aabb.height();
+            xcb_send_event(c, false, request.window, XCB_EVENT_MASK_STRUCTURE_NOTIFY, reinterpret_cast<const char*>(&notify));
+            return;
+        }
+        // values go in the order of the mask bits
+        std::vector<uint32_t> values;
+        const auto add = [&](uint16_t bit, uint32_t value) {
+            if (request.value_mask & bit) {
+                values.push_back(value);
+            }
+        };
+        add(XCB_CONFIG_WINDOW_X, static_cast<uint32_t>(request.x));
+        add(XCB_CONFIG_WINDOW_Y, static_cast<uint32_t>(request.y));
+        add(XCB_CONFIG_WINDOW_WIDTH, request.width);
+        add(XCB_CONFIG_WINDOW_HEIGHT, request.height);
+        add(XCB_CONFIG_WINDOW_BORDER_WIDTH, request.border_width);
+        add(XCB_CONFIG_WINDOW_SIBLING, request.sibling);
+        add(XCB_CONFIG_WINDOW_STACK_MODE, request.stack_mode);
+        xcb_configure_window(c, request.window, request.value_mask, values.data());
+    }
+
+    void collect(cell_t* cell, std::vector<xcb_window_t>& windows) {
+        if (!cell) {
+            return;
+        }
+        if (cell->leaf()) {
+            windows.push_back(cell->window);
+            return;
+        }
+        collect(cell->first.get(), windows);
+        collect(cell->second.get(), windows);
+    }
+};